@@ -0,0 +1,19 @@
+# Runs the benchmarks of the voxel module and prints results as JSON.
+# It doesn't need a GPU, so it can run with a server build of Godot:
+#   godot_server -s modules/voxel/benchmarks/run_benchmarks.gd [seed] [iterations]
+extends SceneTree
+
+func _init():
+	var benchmark = VoxelBenchmark.new()
+
+	var args = OS.get_cmdline_args()
+	for i in range(args.size()):
+		if args[i].ends_with("run_benchmarks.gd"):
+			if args.size() > i + 1:
+				benchmark.set_seed(int(args[i + 1]))
+			if args.size() > i + 2:
+				benchmark.set_iterations(int(args[i + 2]))
+			break
+
+	print(benchmark.run_json())
+	quit()
@@ -0,0 +1,164 @@
+#ifndef VOXEL_RECT3I_H
+#define VOXEL_RECT3I_H
+
+#include "vector3i.h"
+
+// Axis-aligned box of integer positions, size is exclusive
+struct Rect3i {
+
+	Vector3i pos;
+	Vector3i size;
+
+	_FORCE_INLINE_ Rect3i() {}
+
+	_FORCE_INLINE_ Rect3i(Vector3i p_pos, Vector3i p_size) : pos(p_pos), size(p_size) {}
+
+	static _FORCE_INLINE_ Rect3i from_center_extents(Vector3i center, Vector3i extents) {
+		return Rect3i(center - extents, 2 * extents + Vector3i(1, 1, 1));
+	}
+
+	static _FORCE_INLINE_ Rect3i from_min_max(Vector3i min, Vector3i max) {
+		return Rect3i(min, max - min);
+	}
+
+	_FORCE_INLINE_ Vector3i get_max() const {
+		return pos + size;
+	}
+
+	_FORCE_INLINE_ bool is_empty() const {
+		return size.x <= 0 || size.y <= 0 || size.z <= 0;
+	}
+
+	_FORCE_INLINE_ bool contains(Vector3i p) const {
+		Vector3i max = get_max();
+		return p.x >= pos.x && p.y >= pos.y && p.z >= pos.z
+			&& p.x < max.x && p.y < max.y && p.z < max.z;
+	}
+
+	_FORCE_INLINE_ bool intersects(const Rect3i & other) const {
+		Vector3i max = get_max();
+		Vector3i other_max = other.get_max();
+		return pos.x < other_max.x && pos.y < other_max.y && pos.z < other_max.z
+			&& other.pos.x < max.x && other.pos.y < max.y && other.pos.z < max.z;
+	}
+
+	_FORCE_INLINE_ bool operator==(const Rect3i & other) const {
+		return pos == other.pos && size == other.size;
+	}
+
+	// Smallest box containing both boxes
+	static Rect3i get_bounding_box(const Rect3i & a, const Rect3i & b) {
+		if (a.is_empty()) {
+			return b;
+		}
+		if (b.is_empty()) {
+			return a;
+		}
+		Vector3i a_max = a.get_max();
+		Vector3i b_max = b.get_max();
+		return from_min_max(
+			Vector3i(MIN(a.pos.x, b.pos.x), MIN(a.pos.y, b.pos.y), MIN(a.pos.z, b.pos.z)),
+			Vector3i(MAX(a_max.x, b_max.x), MAX(a_max.y, b_max.y), MAX(a_max.z, b_max.z)));
+	}
+
+	// Part of the box that is inside the other one
+	Rect3i clipped(const Rect3i & other) const {
+		Vector3i max = get_max();
+		Vector3i other_max = other.get_max();
+		Rect3i r = from_min_max(
+			Vector3i(MAX(pos.x, other.pos.x), MAX(pos.y, other.pos.y), MAX(pos.z, other.pos.z)),
+			Vector3i(MIN(max.x, other_max.x), MIN(max.y, other_max.y), MIN(max.z, other_max.z)));
+		return r.is_empty() ? Rect3i() : r;
+	}
+
+	// Grows the box by the given amount on all sides
+	_FORCE_INLINE_ Rect3i padded(int margin) const {
+		return Rect3i(pos - Vector3i(margin, margin, margin), size + Vector3i(2 * margin, 2 * margin, 2 * margin));
+	}
+
+	// Grows the box so its bounds fall on multiples of step
+	Rect3i snapped(int step) const {
+		if (is_empty()) {
+			return *this;
+		}
+		Vector3i max = get_max();
+		Vector3i snapped_min(floor_div(pos.x, step), floor_div(pos.y, step), floor_div(pos.z, step));
+		Vector3i snapped_max(ceil_div(max.x, step), ceil_div(max.y, step), ceil_div(max.z, step));
+		return from_min_max(snapped_min * step, snapped_max * step);
+	}
+
+	// Converts the box into a grid where cells are step times larger. The result covers the whole box.
+	Rect3i downscaled(int step) const {
+		if (is_empty()) {
+			return Rect3i();
+		}
+		Vector3i max = get_max();
+		return from_min_max(
+			Vector3i(floor_div(pos.x, step), floor_div(pos.y, step), floor_div(pos.z, step)),
+			Vector3i(ceil_div(max.x, step), ceil_div(max.y, step), ceil_div(max.z, step)));
+	}
+
+	// Calls action(Vector3i) for every position in the box
+	template <typename A>
+	void for_each(A & action) const {
+		Vector3i max = get_max();
+		Vector3i p;
+		for (p.z = pos.z; p.z < max.z; ++p.z) {
+			for (p.x = pos.x; p.x < max.x; ++p.x) {
+				for (p.y = pos.y; p.y < max.y; ++p.y) {
+					action(p);
+				}
+			}
+		}
+	}
+
+	// Calls action(Vector3i) for every position that is in a but not in b.
+	// The difference is split into up to 6 boxes, so the cost only depends on how many positions there are in it.
+	template <typename A>
+	static void difference(const Rect3i & a, const Rect3i & b, A & action) {
+
+		if (a.is_empty()) {
+			return;
+		}
+		if (!a.intersects(b)) {
+			a.for_each(action);
+			return;
+		}
+
+		Vector3i a_min = a.pos;
+		Vector3i a_max = a.get_max();
+		Vector3i b_min = b.pos;
+		Vector3i b_max = b.get_max();
+
+		// Peel slabs of a off along each axis, the remaining core is inside b
+		for (unsigned int axis = 0; axis < 3; ++axis) {
+
+			if (a_min[axis] < b_min[axis]) {
+				Vector3i slab_max = a_max;
+				slab_max[axis] = b_min[axis];
+				Rect3i::from_min_max(a_min, slab_max).for_each(action);
+				a_min[axis] = b_min[axis];
+			}
+
+			if (a_max[axis] > b_max[axis]) {
+				Vector3i slab_min = a_min;
+				slab_min[axis] = b_max[axis];
+				Rect3i::from_min_max(slab_min, a_max).for_each(action);
+				a_max[axis] = b_max[axis];
+			}
+		}
+	}
+
+private:
+	// Integer division rounding towards negative infinity, for positive divisors
+	static _FORCE_INLINE_ int floor_div(int a, int b) {
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	static _FORCE_INLINE_ int ceil_div(int a, int b) {
+		return -floor_div(-a, b);
+	}
+
+};
+
+#endif // VOXEL_RECT3I_H
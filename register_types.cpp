@@ -5,7 +5,9 @@
 #include "voxel_library.h"
 #include "voxel_map.h"
 #include "voxel_terrain.h"
+#include "voxel_terrain_streamer.h"
 #include "voxel_provider_test.h"
+#include "voxel_benchmark.h"
 
 void register_voxel_types() {
 
@@ -16,8 +18,10 @@ void register_voxel_types() {
 	ObjectTypeDB::register_type<VoxelLibrary>();
 	ObjectTypeDB::register_type<VoxelMap>();
 	ObjectTypeDB::register_type<VoxelTerrain>();
+	ObjectTypeDB::register_type<VoxelTerrainStreamer>();
 	ObjectTypeDB::register_type<VoxelProvider>();
 	ObjectTypeDB::register_type<VoxelProviderTest>();
+	ObjectTypeDB::register_type<VoxelBenchmark>();
 
 }
 
@@ -7,6 +7,7 @@ Voxel::Voxel() : Reference(),
 	_material_id(0),
 	_is_transparent(false),
 	_hidden_faces(0),
+	_is_cube(false),
 	_library(NULL),
 	_color(1.f, 1.f, 1.f)
 {}
@@ -32,20 +33,29 @@ Ref<Voxel> Voxel::set_color(Color color) {
 Ref<Voxel> Voxel::set_material_id(unsigned int id) {
 	ERR_FAIL_COND_V(id >= VoxelMesher::MAX_MATERIALS, Ref<Voxel>(this));
 	_material_id = id;
+	update_library();
 	return Ref<Voxel>(this);
 }
 
 Ref<Voxel> Voxel::set_transparent(bool t) {
 	_is_transparent = t;
+	update_library();
 	return Ref<Voxel>(this);
 }
 
+void Voxel::update_library() {
+	if (_library != NULL && _id != -1) {
+		_library->bake_voxel(_id);
+	}
+}
+
 Ref<Voxel> Voxel::hide_faces(Array faces) {
 	for (int i = 0; i < faces.size(); i++) {
 		int face = faces[i];
 		_hidden_faces |= 1 << face;
 	}
 
+	update_library();
 	return Ref<Voxel>(this);
 }
 
@@ -115,6 +125,9 @@ Ref<Voxel> Voxel::set_cube_geometry(float sy) {
 		}
 	}
 
+	_is_cube = (sy == 1.f);
+
+	update_library();
 	return Ref<Voxel>(this);
 }
 
@@ -184,6 +197,8 @@ Ref<Voxel> Voxel::set_cube_uv_tbs_sides(Vector2 top_atlas_pos, Vector2 side_atla
 Ref<Voxel> Voxel::set_cube_geometry_from_mesh(Ref<Mesh> mesh) {
 	ERR_FAIL_COND_V(mesh.is_null(), Ref<Voxel>());
 
+	_is_cube = false;
+
 	int surfaceIdx = 0;
 	ERR_FAIL_COND_V(mesh->surface_get_primitive_type(surfaceIdx) != Mesh::PRIMITIVE_TRIANGLES, Ref<Voxel>());
 
@@ -239,6 +254,7 @@ Ref<Voxel> Voxel::set_cube_geometry_from_mesh(Ref<Mesh> mesh) {
 		}
 	}
 
+	update_library();
 	return Ref<Voxel>(this);
 }
 
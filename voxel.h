@@ -67,10 +67,14 @@ public:
 	const DVector<Vector3> & get_model_side_vertices(unsigned int side) const { return _model_side_vertices[side]; }
 	const DVector<Vector2> & get_model_side_uv(unsigned int side) const { return _model_side_uv[side]; }
 
+	// True if sides are those of a full unit cube, as made by set_cube_geometry()
+	_FORCE_INLINE_ bool is_cube() const { return _is_cube; }
+
 	void set_library_ptr(VoxelLibrary * lib) { _library = lib; }
 
     Ref<Voxel> hide_faces(Array faces);
     _FORCE_INLINE_ bool is_face_visible(int face) const { return !(_hidden_faces & (1 << face));}
+    _FORCE_INLINE_ uint8_t get_hidden_faces() const { return _hidden_faces; }
 
 protected:
 	Ref<Voxel> _set_cube_uv_sides(const Vector2 atlas_pos[6]);
@@ -78,6 +82,9 @@ protected:
 	static void _bind_methods();
 
 private:
+	// Updates what the library baked from this voxel
+	void update_library();
+
 	VoxelLibrary * _library;
 
 	// Identifiers
@@ -88,6 +95,7 @@ private:
 	int _material_id;
 	bool _is_transparent;
 	uint8_t _hidden_faces;
+	bool _is_cube;
 
 	// Model
 	Color _color;
@@ -0,0 +1,493 @@
+#include "voxel_benchmark.h"
+#include "voxel_provider_test.h"
+#include "voxel_illumination.h"
+#include <os/os.h>
+
+// Channels used by illumination benchmarks
+static const unsigned int SOLID_CHANNEL = 0;
+static const unsigned int LIGHT_CHANNEL = 1;
+static const int LIGHT_MAX = 14;
+
+VoxelBenchmark::VoxelBenchmark() :
+	_seed(1234),
+	_iterations(4),
+	_map_size(6, 4, 6)
+{
+	_library = Ref<VoxelLibrary>(memnew(VoxelLibrary));
+	_library->create_voxel(1, "solid")->set_cube_geometry()->set_cube_uv_all_sides(Vector2(0, 0));
+
+	_mesher = Ref<VoxelMesher>(memnew(VoxelMesher));
+	_mesher->set_library(_library);
+}
+
+void VoxelBenchmark::set_iterations(int iterations) {
+	ERR_FAIL_COND(iterations < 1);
+	_iterations = iterations;
+}
+
+uint32_t VoxelBenchmark::random(uint32_t & seed, uint32_t max) const {
+	return Math::rand_from_seed(&seed) % max;
+}
+
+Vector3i VoxelBenchmark::random_voxel_pos(uint32_t & seed) const {
+	const Vector3i size = VoxelMap::block_to_voxel(_map_size);
+	return Vector3i(random(seed, size.x), random(seed, size.y), random(seed, size.z));
+}
+
+// Fills a new map with blocks made by VoxelProviderTest, the ground is half-way up
+void VoxelBenchmark::create_terrain(int mode) {
+
+	Ref<VoxelProviderTest> provider = Ref<VoxelProviderTest>(memnew(VoxelProviderTest));
+	provider->set_mode((VoxelProviderTest::Mode)mode);
+	provider->set_pattern_size(Vector3i(30, 8, 30));
+	provider->set_pattern_offset(Vector3i(0, VoxelMap::block_to_voxel(_map_size).y / 2, 0));
+
+	_map = Ref<VoxelMap>(memnew(VoxelMap));
+
+	Vector3i bpos;
+	for (bpos.z = 0; bpos.z < _map_size.z; ++bpos.z) {
+		for (bpos.x = 0; bpos.x < _map_size.x; ++bpos.x) {
+			for (bpos.y = 0; bpos.y < _map_size.y; ++bpos.y) {
+				Ref<VoxelBuffer> buffer = Ref<VoxelBuffer>(memnew(VoxelBuffer));
+				buffer->create(VoxelBlock::SIZE, VoxelBlock::SIZE, VoxelBlock::SIZE);
+				provider->emerge_block(buffer, bpos);
+				_map->set_block_buffer(bpos, buffer);
+			}
+		}
+	}
+}
+
+void VoxelBenchmark::add_result(Array & results, String name, int iterations, uint64_t time_usec, int64_t items) const {
+	Dictionary result;
+	result["name"] = name;
+	result["iterations"] = iterations;
+	result["items"] = items;
+	result["total_usec"] = (int64_t)time_usec;
+	result["usec_per_iteration"] = double(time_usec) / double(iterations);
+	result["items_per_second"] = time_usec == 0 ? 0.0 : double(items) * 1000000.0 / double(time_usec);
+	results.push_back(result);
+}
+
+void VoxelBenchmark::run_buffer(Array & results) {
+	OS & os = *OS::get_singleton();
+
+	const int size = 2 * VoxelBlock::SIZE;
+	const int64_t volume = size * size * size;
+
+	VoxelBuffer buffer;
+	buffer.create(size, size, size);
+	VoxelBuffer other;
+	other.create(size, size, size);
+
+	uint64_t time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		buffer.fill(i + 1);
+	}
+	add_result(results, "buffer_fill", _iterations, os.get_ticks_usec() - time_before, volume * _iterations);
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int z = 0; z < size; ++z) {
+			for (int x = 0; x < size; ++x) {
+				for (int y = 0; y < size; ++y) {
+					buffer.set_voxel((x + y + z) & 0xff, x, y, z);
+				}
+			}
+		}
+	}
+	add_result(results, "buffer_set_voxel", _iterations, os.get_ticks_usec() - time_before, volume * _iterations);
+
+	int64_t checksum = 0;
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int z = 0; z < size; ++z) {
+			for (int x = 0; x < size; ++x) {
+				for (int y = 0; y < size; ++y) {
+					checksum += buffer.get_voxel(x, y, z);
+				}
+			}
+		}
+	}
+	add_result(results, "buffer_get_voxel", _iterations, os.get_ticks_usec() - time_before, volume * _iterations);
+	// Keeps the compiler from removing the loop
+	ERR_FAIL_COND(checksum < 0);
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		other.copy_from(buffer);
+	}
+	add_result(results, "buffer_copy", _iterations, os.get_ticks_usec() - time_before, volume * _iterations);
+
+	const Vector3i half(size / 2, size / 2, size / 2);
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		other.copy_from(buffer, Vector3i(), half, half);
+	}
+	add_result(results, "buffer_copy_area", _iterations, os.get_ticks_usec() - time_before, volume / 8 * _iterations);
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		other.fill_area(i, Vector3i(), half);
+	}
+	add_result(results, "buffer_fill_area", _iterations, os.get_ticks_usec() - time_before, volume / 8 * _iterations);
+
+	// Worst case, the only different voxel is the last one
+	buffer.fill(1);
+	buffer.set_voxel(2, size - 1, size - 1, size - 1);
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		buffer.is_uniform();
+	}
+	add_result(results, "buffer_is_uniform", _iterations, os.get_ticks_usec() - time_before, volume * _iterations);
+}
+
+void VoxelBenchmark::run_map(Array & results) {
+	OS & os = *OS::get_singleton();
+
+	create_terrain(VoxelProviderTest::MODE_WAVES);
+	VoxelMap & map = **_map;
+
+	const Vector3i size = VoxelMap::block_to_voxel(_map_size);
+	const int64_t volume = size.x * size.y * size.z;
+	int64_t checksum = 0;
+
+	uint64_t time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		Vector3i pos;
+		for (pos.z = 0; pos.z < size.z; ++pos.z) {
+			for (pos.x = 0; pos.x < size.x; ++pos.x) {
+				for (pos.y = 0; pos.y < size.y; ++pos.y) {
+					checksum += map.get_voxel(pos);
+				}
+			}
+		}
+	}
+	add_result(results, "map_sequential_get", _iterations, os.get_ticks_usec() - time_before, volume * _iterations);
+
+	// Positions are drawn before timing
+	const int count = volume / 8;
+	Vector<Vector3i> positions;
+	positions.resize(count);
+	uint32_t seed = _seed;
+	for (int i = 0; i < count; ++i) {
+		positions[i] = random_voxel_pos(seed);
+	}
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			checksum += map.get_voxel(positions[j]);
+		}
+	}
+	add_result(results, "map_random_get", _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			map.set_voxel((i + j) & 1, positions[j]);
+		}
+	}
+	add_result(results, "map_random_set", _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	ERR_FAIL_COND(checksum < 0);
+}
+
+void VoxelBenchmark::run_mesher(Array & results, String terrain_name) {
+	OS & os = *OS::get_singleton();
+
+	// Blocks on the sides of the map miss neighbors, only inner ones are meshed
+	Vector<Vector3i> block_positions;
+	Vector3i bpos;
+	for (bpos.z = 1; bpos.z < _map_size.z - 1; ++bpos.z) {
+		for (bpos.x = 1; bpos.x < _map_size.x - 1; ++bpos.x) {
+			for (bpos.y = 1; bpos.y < _map_size.y - 1; ++bpos.y) {
+				block_positions.push_back(bpos);
+			}
+		}
+	}
+	const int count = block_positions.size();
+	const int padded_size = VoxelBlock::SIZE + 2;
+
+	Vector<Ref<VoxelBuffer> > buffers;
+	for (int i = 0; i < count; ++i) {
+		Ref<VoxelBuffer> buffer = Ref<VoxelBuffer>(memnew(VoxelBuffer));
+		buffer->create(padded_size, padded_size, padded_size);
+		buffers.push_back(buffer);
+	}
+
+	uint64_t time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			Vector3i min_pos = VoxelMap::block_to_voxel(block_positions[j]) - Vector3i(1, 1, 1);
+			_map->get_buffer_copy(min_pos, **buffers[j], SOLID_CHANNEL);
+			_map->get_buffer_copy(min_pos, **buffers[j], LIGHT_CHANNEL);
+		}
+	}
+	add_result(results, "map_buffer_copy_" + terrain_name, _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	int64_t vertices = 0;
+	VoxelMesher::Scratch scratch;
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			VoxelMesher::Output output;
+			_mesher->build_arrays(**buffers[j], SOLID_CHANNEL, output, scratch);
+			vertices += output.get_vertex_count();
+		}
+	}
+	add_result(results, "mesher_build_arrays_" + terrain_name, _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	// Same, reading neighbor blocks where they are, instead of copying them first
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			Ref<VoxelBuffer> blocks[27];
+			int k = 0;
+			Vector3i d;
+			for (d.z = -1; d.z < 2; ++d.z) {
+				for (d.x = -1; d.x < 2; ++d.x) {
+					for (d.y = -1; d.y < 2; ++d.y) {
+						VoxelBlock * block = _map->get_block(block_positions[j] + d);
+						if (block) {
+							blocks[k] = block->voxels;
+						}
+						++k;
+					}
+				}
+			}
+			VoxelMesher::Output output;
+			_mesher->build_arrays(VoxelNeighborhood(blocks, 0), SOLID_CHANNEL, output, scratch);
+			vertices += output.get_vertex_count();
+		}
+	}
+	add_result(results, "mesher_build_arrays_neighborhood_" + terrain_name, _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			_mesher->build(**buffers[j], SOLID_CHANNEL);
+		}
+	}
+	add_result(results, "mesher_build_" + terrain_name, _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	time_before = os.get_ticks_usec();
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			_mesher->build_lighted(buffers[j], SOLID_CHANNEL, LIGHT_CHANNEL, VoxelMap::block_to_voxel(block_positions[j]));
+		}
+	}
+	add_result(results, "mesher_build_lighted_" + terrain_name, _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+	ERR_FAIL_COND(vertices < 0);
+}
+
+// Compares bitmask and per-voxel face culling on blocks of 16 and 32 voxels, across the ground
+void VoxelBenchmark::run_face_culling(Array & results) {
+	OS & os = *OS::get_singleton();
+
+	const Vector3i size = VoxelMap::block_to_voxel(_map_size);
+	const int block_sizes[2] = { 16, 32 };
+
+	for (int i = 0; i < 2; ++i) {
+		const int block_size = block_sizes[i];
+		const int padded_size = block_size + 2;
+
+		Vector<Ref<VoxelBuffer> > buffers;
+		for (int z = 0; z + padded_size <= size.z; z += block_size) {
+			for (int x = 0; x + padded_size <= size.x; x += block_size) {
+				Ref<VoxelBuffer> buffer = Ref<VoxelBuffer>(memnew(VoxelBuffer));
+				buffer->create(padded_size, padded_size, padded_size);
+				_map->get_buffer_copy(Vector3i(x, size.y / 2 - padded_size / 2, z), **buffer, SOLID_CHANNEL);
+				buffers.push_back(buffer);
+			}
+		}
+		const int count = buffers.size();
+
+		for (int bitmask = 0; bitmask < 2; ++bitmask) {
+			_mesher->set_bitmask_culling(bitmask == 1);
+
+			int64_t vertices = 0;
+			VoxelMesher::Scratch scratch;
+			uint64_t time_before = os.get_ticks_usec();
+			for (int j = 0; j < _iterations; ++j) {
+				for (int k = 0; k < count; ++k) {
+					VoxelMesher::Output output;
+					_mesher->build_arrays(**buffers[k], SOLID_CHANNEL, output, scratch);
+					vertices += output.get_vertex_count();
+				}
+			}
+			String name = bitmask == 1 ? "mesher_culling_bitmask_" : "mesher_culling_per_voxel_";
+			add_result(results, name + itos(block_size), _iterations, os.get_ticks_usec() - time_before, int64_t(count) * _iterations);
+
+			ERR_FAIL_COND(vertices < 0);
+		}
+	}
+
+	_mesher->set_bitmask_culling(true);
+}
+
+// Remeshing a 32x32x32 block after digging or placing single voxels, entirely or only the slabs they touch
+void VoxelBenchmark::run_partial_remesh(Array & results) {
+	OS & os = *OS::get_singleton();
+
+	const int block_size = 32;
+	const int padded_size = block_size + 2;
+	const Vector3i size = VoxelMap::block_to_voxel(_map_size);
+
+	VoxelBuffer buffer;
+	buffer.create(padded_size, padded_size, padded_size);
+	_map->get_buffer_copy(Vector3i(0, size.y / 2 - padded_size / 2, 0), buffer, SOLID_CHANNEL);
+
+	VoxelMesher::Scratch scratch;
+	Vector<VoxelMesher::Output> slabs;
+	_mesher->build_slabs(buffer, SOLID_CHANNEL, slabs, VoxelMesher::ALL_SLABS, scratch);
+
+	for (int partial = 0; partial < 2; ++partial) {
+		int64_t vertices = 0;
+		uint32_t seed = _seed;
+		uint64_t time_before = os.get_ticks_usec();
+
+		for (int j = 0; j < _iterations; ++j) {
+			// Same edits both times, each one undoes the previous
+			Vector3i pos;
+			pos.x = 1 + random(seed, block_size);
+			pos.y = 1 + random(seed, block_size);
+			pos.z = 1 + random(seed, block_size);
+			buffer.set_voxel(j & 1, pos, SOLID_CHANNEL);
+
+			VoxelMesher::Output output;
+			if (partial == 1) {
+				const int y = pos.y - 1;
+				_mesher->build_slabs(buffer, SOLID_CHANNEL, slabs, VoxelMesher::get_slabs_in_range(y - 1, MIN(y + 1, block_size - 1)), scratch);
+				VoxelMesher::merge_slabs(slabs, output);
+			}
+			else {
+				_mesher->build_arrays(buffer, SOLID_CHANNEL, output, scratch);
+			}
+			vertices += output.get_vertex_count();
+		}
+
+		add_result(results, partial == 1 ? "mesher_remesh_slabs_32" : "mesher_remesh_full_32", _iterations, os.get_ticks_usec() - time_before, _iterations);
+		ERR_FAIL_COND(vertices < 0);
+	}
+}
+
+// Bytes of mesh arrays per vertex, indices included, with and without compact vertices.
+// Compact vertices only change meshes having colors, which come with occlusion.
+Dictionary VoxelBenchmark::measure_vertex_size() {
+
+	const int padded_size = VoxelBlock::SIZE + 2;
+	const Vector3i size = VoxelMap::block_to_voxel(_map_size);
+
+	VoxelBuffer buffer;
+	buffer.create(padded_size, padded_size, padded_size);
+	_map->get_buffer_copy(Vector3i(0, size.y / 2 - padded_size / 2, 0), buffer, SOLID_CHANNEL);
+
+	const bool occlusion_enabled = _mesher->get_occlusion_enabled();
+
+	Dictionary d;
+	for (int occlusion = 0; occlusion < 2; ++occlusion) {
+		_mesher->set_occlusion_enabled(occlusion == 1);
+		Dictionary sizes;
+		for (int compact = 0; compact < 2; ++compact) {
+			_mesher->set_compact_vertices(compact == 1);
+			VoxelMesher::Output output;
+			_mesher->build_arrays(buffer, SOLID_CHANNEL, output);
+			const int vertex_count = output.get_vertex_count();
+			sizes[compact == 1 ? "compact" : "default"] = vertex_count == 0 ? 0.0 : double(output.get_memory_usage()) / double(vertex_count);
+		}
+		d[occlusion == 1 ? "occlusion" : "no_occlusion"] = sizes;
+	}
+	_mesher->set_compact_vertices(false);
+	_mesher->set_occlusion_enabled(occlusion_enabled);
+
+	return d;
+}
+
+void VoxelBenchmark::run_illumination(Array & results) {
+	OS & os = *OS::get_singleton();
+
+	create_terrain(VoxelProviderTest::MODE_WAVES);
+
+	Ref<VoxelIllumination> illumination = Ref<VoxelIllumination>(memnew(VoxelIllumination));
+	illumination->set_library(_library);
+	illumination->set_map(_map);
+
+	// Light sources in the air above the ground
+	const Vector3i size = VoxelMap::block_to_voxel(_map_size);
+	const int count = 64;
+	DVector<Vector3> sources;
+	uint32_t seed = _seed;
+	while (sources.size() < count) {
+		Vector3i pos = random_voxel_pos(seed);
+		pos.y = size.y / 2 + 8 + random(seed, size.y / 2 - 8);
+		if (_map->get_voxel(pos, SOLID_CHANNEL) == 0) {
+			sources.push_back(pos.to_vec3());
+		}
+	}
+
+	uint64_t spread_time = 0;
+	uint64_t remove_time = 0;
+
+	for (int i = 0; i < _iterations; ++i) {
+		for (int j = 0; j < count; ++j) {
+			_map->set_voxel(LIGHT_MAX, Vector3i(sources.get(j)), LIGHT_CHANNEL);
+		}
+
+		uint64_t time_before = os.get_ticks_usec();
+		illumination->call("spread_ambient_light", SOLID_CHANNEL, LIGHT_CHANNEL, sources);
+		spread_time += os.get_ticks_usec() - time_before;
+
+		time_before = os.get_ticks_usec();
+		illumination->call("remove_ambient_light", SOLID_CHANNEL, LIGHT_CHANNEL, sources);
+		remove_time += os.get_ticks_usec() - time_before;
+	}
+
+	add_result(results, "illumination_spread", _iterations, spread_time, int64_t(count) * _iterations);
+	add_result(results, "illumination_remove", _iterations, remove_time, int64_t(count) * _iterations);
+}
+
+Dictionary VoxelBenchmark::run() {
+
+	Array results;
+
+	run_buffer(results);
+	run_map(results);
+
+	create_terrain(VoxelProviderTest::MODE_FLAT);
+	run_mesher(results, "flat");
+	create_terrain(VoxelProviderTest::MODE_WAVES);
+	run_mesher(results, "waves");
+	run_face_culling(results);
+	run_partial_remesh(results);
+	Dictionary vertex_size = measure_vertex_size();
+
+	run_illumination(results);
+
+	// Don't keep the terrain around between runs
+	_map = Ref<VoxelMap>();
+
+	Dictionary d;
+	d["seed"] = _seed;
+	d["iterations"] = _iterations;
+	d["block_size"] = VoxelBlock::SIZE;
+	d["vertex_bytes"] = vertex_size;
+	d["results"] = results;
+	return d;
+}
+
+String VoxelBenchmark::run_json() {
+	return run().to_json();
+}
+
+void VoxelBenchmark::_bind_methods() {
+
+	ObjectTypeDB::bind_method(_MD("set_seed", "seed"), &VoxelBenchmark::set_seed);
+	ObjectTypeDB::bind_method(_MD("get_seed"), &VoxelBenchmark::get_seed);
+
+	ObjectTypeDB::bind_method(_MD("set_iterations", "iterations"), &VoxelBenchmark::set_iterations);
+	ObjectTypeDB::bind_method(_MD("get_iterations"), &VoxelBenchmark::get_iterations);
+
+	ObjectTypeDB::bind_method(_MD("run"), &VoxelBenchmark::run);
+	ObjectTypeDB::bind_method(_MD("run_json"), &VoxelBenchmark::run_json);
+}
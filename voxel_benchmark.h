@@ -0,0 +1,59 @@
+#ifndef VOXEL_BENCHMARK_H
+#define VOXEL_BENCHMARK_H
+
+#include <reference.h>
+#include "voxel_map.h"
+#include "voxel_mesher.h"
+#include "voxel_library.h"
+
+// Measures the throughput of the module on synthetic terrain made by VoxelProviderTest.
+// It doesn't need a GPU, so it can run on the server platform, see benchmarks/run_benchmarks.gd.
+// Random positions come from a fixed seed, so two runs do the same work.
+class VoxelBenchmark : public Reference {
+	OBJ_TYPE(VoxelBenchmark, Reference)
+public:
+	VoxelBenchmark();
+
+	void set_seed(int seed) { _seed = seed; }
+	int get_seed() const { return _seed; }
+
+	// How many times each benchmark repeats its work
+	void set_iterations(int iterations);
+	int get_iterations() const { return _iterations; }
+
+	// Runs all benchmarks. Each result has a name, how many iterations and items were processed,
+	// the total time and the time per iteration in microseconds, and items per second.
+	// vertex_bytes tells how many bytes a vertex takes in mesh arrays, with and without compact vertices,
+	// when occlusion is on and off.
+	Dictionary run();
+	String run_json();
+
+protected:
+	static void _bind_methods();
+
+private:
+	void create_terrain(int mode);
+	uint32_t random(uint32_t & seed, uint32_t max) const;
+	Vector3i random_voxel_pos(uint32_t & seed) const;
+
+	void add_result(Array & results, String name, int iterations, uint64_t time_usec, int64_t items) const;
+
+	void run_buffer(Array & results);
+	void run_map(Array & results);
+	void run_mesher(Array & results, String terrain_name);
+	void run_face_culling(Array & results);
+	void run_partial_remesh(Array & results);
+	Dictionary measure_vertex_size();
+	void run_illumination(Array & results);
+
+	int _seed;
+	int _iterations;
+
+	Ref<VoxelLibrary> _library;
+	Ref<VoxelMesher> _mesher;
+	Ref<VoxelMap> _map;
+	// Blocks of the map, in blocks
+	Vector3i _map_size;
+};
+
+#endif // VOXEL_BENCHMARK_H
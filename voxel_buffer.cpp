@@ -148,9 +148,19 @@ void VoxelBuffer::optimize() {
 	}
 }
 
+int VoxelBuffer::get_memory_usage() const {
+	int size = 0;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		if (_channels[i].data) {
+			size += _size.x * _size.y * _size.z * sizeof(uint16_t);
+		}
+	}
+	return size;
+}
+
 void VoxelBuffer::copy_from(const VoxelBuffer & other, unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
-	ERR_FAIL_COND(other._size == _size);
+	ERR_FAIL_COND(!(other._size == _size));
 
 	Channel & channel = _channels[channel_index];
 	const Channel & other_channel = other._channels[channel_index];
@@ -40,6 +40,9 @@ public:
 
 	void optimize();
 
+	// Bytes allocated for voxels, channels that are not populated take none
+	int get_memory_usage() const;
+
 	void copy_from(const VoxelBuffer & other, unsigned int channel_index=0);
 	void copy_from(const VoxelBuffer & other, Vector3i src_min, Vector3i src_max, Vector3i dst_min, unsigned int channel_index = 0);
 
@@ -0,0 +1,138 @@
+#include "voxel_connectivity.h"
+
+uint16_t VoxelConnectivity::get_pair_bit(unsigned int side_a, unsigned int side_b) {
+	if (side_a == side_b) {
+		return 0;
+	}
+	if (side_a > side_b) {
+		SWAP(side_a, side_b);
+	}
+	// Pairs are numbered in order (0,1), (0,2)...(0,5), (1,2)...(4,5)
+	unsigned int index = side_a * Voxel::SIDE_COUNT - side_a * (side_a + 1) / 2 + (side_b - side_a - 1);
+	return 1 << index;
+}
+
+bool VoxelConnectivity::is_opaque(const VoxelLibrary & library, int voxel_id) {
+	if (!library.has_voxel(voxel_id)) {
+		return false;
+	}
+	const Voxel & voxel = library.get_voxel_const(voxel_id);
+	if (voxel.is_transparent() || voxel.get_model_vertices().size() != 0) {
+		return false;
+	}
+	// A face that is missing or hidden lets sight through
+	for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+		if (!voxel.is_face_visible(side) || voxel.get_model_side_vertices(side).size() == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint16_t VoxelConnectivity::compute(const VoxelBuffer & voxels, unsigned int channel, const VoxelLibrary & library) {
+
+	const Vector3i size = voxels.get_size();
+	const int volume = size.x * size.y * size.z;
+	if (volume == 0) {
+		return ALL;
+	}
+
+	// Voxel types are few, remember which ones are opaque
+	const int cached_types = 256;
+	int8_t opaque_cache[cached_types];
+	for (int i = 0; i < cached_types; ++i) {
+		opaque_cache[i] = -1;
+	}
+
+	// 1 for voxels that block sight or were already reached
+	Vector<uint8_t> closed;
+	closed.resize(volume);
+
+	int i = 0;
+	Vector3i pos;
+	for (pos.z = 0; pos.z < size.z; ++pos.z) {
+		for (pos.x = 0; pos.x < size.x; ++pos.x) {
+			for (pos.y = 0; pos.y < size.y; ++pos.y) {
+				int v = voxels.get_voxel(pos, channel);
+				bool opaque;
+				if (v < cached_types) {
+					if (opaque_cache[v] == -1) {
+						opaque_cache[v] = is_opaque(library, v) ? 1 : 0;
+					}
+					opaque = opaque_cache[v] == 1;
+				} else {
+					opaque = is_opaque(library, v);
+				}
+				closed[i++] = opaque ? 1 : 0;
+			}
+		}
+	}
+
+	// Same [z][x][y] order as the loop above
+	const int stride_y = 1;
+	const int stride_x = size.y;
+	const int stride_z = size.y * size.x;
+
+	uint16_t connectivity = 0;
+	Vector<Vector3i> stack;
+
+	i = 0;
+	Vector3i seed;
+	for (seed.z = 0; seed.z < size.z; ++seed.z) {
+		for (seed.x = 0; seed.x < size.x; ++seed.x) {
+			for (seed.y = 0; seed.y < size.y; ++seed.y, ++i) {
+
+				if (closed[i]) {
+					continue;
+				}
+
+				// Flood-fill the open area containing this voxel, and note which faces it touches
+				uint8_t faces = 0;
+				closed[i] = 1;
+				stack.push_back(seed);
+
+				while (stack.size() != 0) {
+					Vector3i p = stack[stack.size() - 1];
+					stack.resize(stack.size() - 1);
+					int pi = p.z * stride_z + p.x * stride_x + p.y * stride_y;
+
+					if (p.x == 0) faces |= 1 << Voxel::SIDE_LEFT;
+					if (p.x == size.x - 1) faces |= 1 << Voxel::SIDE_RIGHT;
+					if (p.y == 0) faces |= 1 << Voxel::SIDE_BOTTOM;
+					if (p.y == size.y - 1) faces |= 1 << Voxel::SIDE_TOP;
+					if (p.z == 0) faces |= 1 << Voxel::SIDE_BACK;
+					if (p.z == size.z - 1) faces |= 1 << Voxel::SIDE_FRONT;
+
+#define VOXEL_CONNECTIVITY_VISIT(cond, offset, np) \
+	if ((cond) && !closed[pi + (offset)]) { \
+		closed[pi + (offset)] = 1; \
+		stack.push_back(np); \
+	}
+					VOXEL_CONNECTIVITY_VISIT(p.x > 0, -stride_x, Vector3i(p.x - 1, p.y, p.z))
+					VOXEL_CONNECTIVITY_VISIT(p.x < size.x - 1, stride_x, Vector3i(p.x + 1, p.y, p.z))
+					VOXEL_CONNECTIVITY_VISIT(p.y > 0, -stride_y, Vector3i(p.x, p.y - 1, p.z))
+					VOXEL_CONNECTIVITY_VISIT(p.y < size.y - 1, stride_y, Vector3i(p.x, p.y + 1, p.z))
+					VOXEL_CONNECTIVITY_VISIT(p.z > 0, -stride_z, Vector3i(p.x, p.y, p.z - 1))
+					VOXEL_CONNECTIVITY_VISIT(p.z < size.z - 1, stride_z, Vector3i(p.x, p.y, p.z + 1))
+#undef VOXEL_CONNECTIVITY_VISIT
+				}
+
+				for (unsigned int a = 0; a < Voxel::SIDE_COUNT; ++a) {
+					if (faces & (1 << a)) {
+						for (unsigned int b = a + 1; b < Voxel::SIDE_COUNT; ++b) {
+							if (faces & (1 << b)) {
+								connectivity |= get_pair_bit(a, b);
+							}
+						}
+					}
+				}
+
+				if (connectivity == ALL) {
+					return ALL;
+				}
+			}
+		}
+	}
+
+	return connectivity;
+}
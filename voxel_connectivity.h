@@ -0,0 +1,27 @@
+#ifndef VOXEL_CONNECTIVITY_H
+#define VOXEL_CONNECTIVITY_H
+
+#include "voxel_buffer.h"
+#include "voxel_library.h"
+
+// Tells which faces of a block can see each other through voxels that don't block sight.
+// It's stored in a bitmask with one bit per pair of faces (see Voxel::Side), so that the terrain can cull
+// blocks that can't be seen from the camera, like caves seen from the surface.
+class VoxelConnectivity {
+public:
+	// All faces see each other, like in an empty block
+	static const uint16_t ALL = (1 << 15) - 1;
+
+	static uint16_t compute(const VoxelBuffer & voxels, unsigned int channel, const VoxelLibrary & library);
+
+	// True if the voxel fully blocks sight
+	static bool is_opaque(const VoxelLibrary & library, int voxel_id);
+
+	static _FORCE_INLINE_ bool are_connected(uint16_t connectivity, unsigned int side_a, unsigned int side_b) {
+		return (connectivity & get_pair_bit(side_a, side_b)) != 0;
+	}
+
+	static uint16_t get_pair_bit(unsigned int side_a, unsigned int side_b);
+};
+
+#endif // VOXEL_CONNECTIVITY_H
@@ -0,0 +1,106 @@
+#include "voxel_frame_scheduler.h"
+
+// Budgets never go below this, so streaming doesn't stall when the game is slow for other reasons
+static const int MIN_BUDGET_USEC = 500;
+
+// Frame time is allowed to exceed the target by this fraction before budgets get reduced, to absorb jitter
+static const float FRAME_TIME_TOLERANCE = 0.1f;
+
+static const float BUDGET_DECREASE_FACTOR = 0.75f;
+static const float BUDGET_INCREASE_FACTOR = 1.1f;
+
+VoxelFrameScheduler::VoxelFrameScheduler() :
+	_target_frame_time(1000000 / 60),
+	_frame_time(0),
+	_adaptive(true),
+	_frame_begin_time(0),
+	_stage_begin_time(0),
+	_current_stage(STAGE_GENERATION)
+{
+	_budgets[STAGE_GENERATION] = 8000;
+	_budgets[STAGE_MESHING] = 2000;
+	_budgets[STAGE_UPLOAD] = 4000;
+	_budgets[STAGE_COLLISION] = 1000;
+
+	for (unsigned int i = 0; i < STAGE_COUNT; ++i) {
+		_current_budgets[i] = _budgets[i];
+		_stage_times[i] = 0;
+	}
+}
+
+void VoxelFrameScheduler::set_budget_usec(Stage stage, int usec) {
+	ERR_FAIL_INDEX(stage, STAGE_COUNT);
+	ERR_FAIL_COND(usec < 0);
+	_budgets[stage] = usec;
+	_current_budgets[stage] = usec;
+}
+
+int VoxelFrameScheduler::get_budget_usec(Stage stage) const {
+	ERR_FAIL_INDEX_V(stage, STAGE_COUNT, 0);
+	return _budgets[stage];
+}
+
+int VoxelFrameScheduler::get_current_budget_usec(Stage stage) const {
+	ERR_FAIL_INDEX_V(stage, STAGE_COUNT, 0);
+	return _current_budgets[stage];
+}
+
+int VoxelFrameScheduler::get_stage_time_usec(Stage stage) const {
+	ERR_FAIL_INDEX_V(stage, STAGE_COUNT, 0);
+	return _stage_times[stage];
+}
+
+void VoxelFrameScheduler::set_target_frame_time_usec(int usec) {
+	ERR_FAIL_COND(usec <= 0);
+	_target_frame_time = usec;
+}
+
+void VoxelFrameScheduler::set_adaptive(bool adaptive) {
+	_adaptive = adaptive;
+	if (!_adaptive) {
+		for (unsigned int i = 0; i < STAGE_COUNT; ++i) {
+			_current_budgets[i] = _budgets[i];
+		}
+	}
+}
+
+void VoxelFrameScheduler::begin_frame() {
+
+	uint64_t now = OS::get_singleton()->get_ticks_usec();
+	if (_frame_begin_time != 0) {
+		_frame_time = now - _frame_begin_time;
+	}
+	_frame_begin_time = now;
+
+	for (unsigned int i = 0; i < STAGE_COUNT; ++i) {
+		_stage_times[i] = 0;
+	}
+
+	if (!_adaptive || _frame_time == 0) {
+		return;
+	}
+
+	if (_frame_time > _target_frame_time * (1.f + FRAME_TIME_TOLERANCE)) {
+		// Give time back to the game
+		for (unsigned int i = 0; i < STAGE_COUNT; ++i) {
+			int budget = _current_budgets[i] * BUDGET_DECREASE_FACTOR;
+			_current_budgets[i] = MAX(budget, MIN(MIN_BUDGET_USEC, _budgets[i]));
+		}
+	}
+	else {
+		for (unsigned int i = 0; i < STAGE_COUNT; ++i) {
+			// +1 so it can't get stuck on small values
+			int budget = _current_budgets[i] * BUDGET_INCREASE_FACTOR + 1;
+			_current_budgets[i] = MIN(budget, _budgets[i]);
+		}
+	}
+}
+
+void VoxelFrameScheduler::begin_stage(Stage stage) {
+	_current_stage = stage;
+	_stage_begin_time = OS::get_singleton()->get_ticks_usec();
+}
+
+void VoxelFrameScheduler::end_stage() {
+	_stage_times[_current_stage] += OS::get_singleton()->get_ticks_usec() - _stage_begin_time;
+}
@@ -0,0 +1,64 @@
+#ifndef VOXEL_FRAME_SCHEDULER_H
+#define VOXEL_FRAME_SCHEDULER_H
+
+#include <os/os.h>
+
+// Shares the time VoxelTerrain can spend in a frame between its stages.
+// Each stage has its own budget in microseconds. In adaptive mode, budgets shrink when frames take longer
+// than the target frame time, and grow back up to their configured value when there is room again.
+class VoxelFrameScheduler {
+public:
+	enum Stage {
+		STAGE_GENERATION = 0, // Emerging blocks from the provider and storing them in the map
+		STAGE_MESHING, // Scheduling mesh builds
+		STAGE_UPLOAD, // Creating meshes from built arrays
+		STAGE_COLLISION, // Scheduling collision builds and creating their shapes
+		STAGE_COUNT
+	};
+
+	VoxelFrameScheduler();
+
+	void set_budget_usec(Stage stage, int usec);
+	int get_budget_usec(Stage stage) const;
+
+	// Budget actually used this frame, which can be lower than the configured one in adaptive mode
+	int get_current_budget_usec(Stage stage) const;
+
+	void set_target_frame_time_usec(int usec);
+	int get_target_frame_time_usec() const { return _target_frame_time; }
+
+	void set_adaptive(bool adaptive);
+	bool is_adaptive() const { return _adaptive; }
+
+	// Duration of the last frame, as measured between two calls to begin_frame()
+	int get_frame_time_usec() const { return _frame_time; }
+
+	void begin_frame();
+
+	void begin_stage(Stage stage);
+	void end_stage();
+
+	// Stages should do at least one thing per frame before checking this, so they always make progress
+	_FORCE_INLINE_ bool is_over_budget() const {
+		return OS::get_singleton()->get_ticks_usec() - _stage_begin_time >= (uint64_t)_current_budgets[_current_stage];
+	}
+
+	// Time spent in the stage during the last frame
+	int get_stage_time_usec(Stage stage) const;
+
+private:
+	int _budgets[STAGE_COUNT];
+	int _current_budgets[STAGE_COUNT];
+	int _stage_times[STAGE_COUNT];
+
+	int _target_frame_time;
+	int _frame_time;
+	bool _adaptive;
+
+	uint64_t _frame_begin_time;
+	uint64_t _stage_begin_time;
+	Stage _current_stage;
+
+};
+
+#endif // VOXEL_FRAME_SCHEDULER_H
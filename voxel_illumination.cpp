@@ -74,10 +74,9 @@ void VoxelIllumination::spread_ambient_light(unsigned int solid_channel, unsigne
 				changed = true;
 			} else if (neighbour < newlight) {
 				int solid_id = block->voxels->get_voxel(relPos, solid_channel);
-				const Voxel & solid = _library->get_voxel_const(solid_id);
 
-				if (solid.is_transparent()) {
-					block->voxels->set_voxel(newlight.value, relPos,
+				if (_library->get_baked_transparent(solid_id)) {
+					block->get_voxels_for_write().set_voxel(newlight.value, relPos,
 							light_channel);
 					lightedNodes.insert(neighbourPos);
 					changed = true;
@@ -140,10 +139,9 @@ void VoxelIllumination::remove_ambient_light(unsigned int solid_channel, unsigne
 			if (neighbourLight < oldlight) {
 				if (neighbourLight != Light(0)) {
 					int solid_id = block->voxels->get_voxel(relPos, solid_channel);
-					const Voxel & solid = _library->get_voxel_const(solid_id);
 
-					if (solid.is_transparent()) {
-						block->voxels->set_voxel(0, relPos, light_channel);
+					if (_library->get_baked_transparent(solid_id)) {
+						block->get_voxels_for_write().set_voxel(0, relPos, light_channel);
 
 						unlightedVoxels[neighborPos] = neighbourLight;
 						changed = true;
@@ -1,6 +1,12 @@
 #include "voxel_library.h"
 
 VoxelLibrary::VoxelLibrary() : Reference(), _atlas_size(1) {
+	for (unsigned int i = 0; i < MAX_VOXEL_TYPES; ++i) {
+		_baked_transparent[i] = 1;
+		_baked_hidden_faces[i] = 0;
+		_baked_material_id[i] = 0;
+		_baked_geometry[i] = GEOMETRY_NONE;
+	}
 	create_voxel(0, "air")->set_transparent(true);
 }
 
@@ -24,9 +30,45 @@ Ref<Voxel> VoxelLibrary::create_voxel(int id, String name) {
 	voxel->set_id(id);
 	voxel->set_name(name);
 	_voxel_types[id] = voxel;
+	bake_voxel(id);
 	return voxel;
 }
 
+void VoxelLibrary::bake_voxel(int id) {
+	ERR_FAIL_COND(id < 0 || id >= MAX_VOXEL_TYPES);
+
+	if (_voxel_types[id].is_null()) {
+		_baked_transparent[id] = 1;
+		_baked_hidden_faces[id] = 0;
+		_baked_material_id[id] = 0;
+		_baked_geometry[id] = GEOMETRY_NONE;
+		return;
+	}
+
+	const Voxel & voxel = **_voxel_types[id];
+
+	_baked_transparent[id] = voxel.is_transparent() ? 1 : 0;
+	_baked_hidden_faces[id] = voxel.get_hidden_faces();
+	_baked_material_id[id] = voxel.get_material_id();
+
+	bool has_sides = false;
+	for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+		if (voxel.get_model_side_vertices(side).size() != 0) {
+			has_sides = true;
+			break;
+		}
+	}
+	bool has_model = voxel.get_model_vertices().size() != 0;
+
+	if (!has_sides && !has_model) {
+		_baked_geometry[id] = GEOMETRY_NONE;
+	} else if (voxel.is_cube() && !has_model) {
+		_baked_geometry[id] = GEOMETRY_CUBE;
+	} else {
+		_baked_geometry[id] = GEOMETRY_CUSTOM;
+	}
+}
+
 Ref<Voxel> VoxelLibrary::_get_voxel_bind(int id) {
 	ERR_FAIL_COND_V(id < 0 || id >= MAX_VOXEL_TYPES, Ref<Voxel>());
 	return _voxel_types[id];
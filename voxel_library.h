@@ -10,6 +10,12 @@ class VoxelLibrary : public Reference {
 public:
 	static const unsigned int MAX_VOXEL_TYPES = 65536; // Required limit because voxel types are stored in 8 bits
 
+	enum Geometry {
+		GEOMETRY_NONE = 0, // No voxel, or a voxel without geometry, like air
+		GEOMETRY_CUBE, // Unit cube sides only
+		GEOMETRY_CUSTOM
+	};
+
 	VoxelLibrary();
 	~VoxelLibrary();
 
@@ -24,6 +30,16 @@ public:
 	_FORCE_INLINE_ bool has_voxel(int id) const { return _voxel_types[id].is_valid(); }
 	_FORCE_INLINE_ const Voxel & get_voxel_const(int id) const { return **_voxel_types[id]; }
 
+	// Baked properties, copied from voxels into flat arrays so loops going through many voxels
+	// only touch a few bytes per type. Missing voxels are transparent and have no geometry.
+	_FORCE_INLINE_ bool get_baked_transparent(int id) const { return _baked_transparent[id] != 0; }
+	_FORCE_INLINE_ uint8_t get_baked_hidden_faces(int id) const { return _baked_hidden_faces[id]; }
+	_FORCE_INLINE_ unsigned int get_baked_material_id(int id) const { return _baked_material_id[id]; }
+	_FORCE_INLINE_ Geometry get_baked_geometry(int id) const { return static_cast<Geometry>(_baked_geometry[id]); }
+
+	// Updates baked properties of a voxel type. Voxels call it when they change.
+	void bake_voxel(int id);
+
 protected:
 	static void _bind_methods();
 
@@ -33,6 +49,11 @@ private:
 	Ref<Voxel> _voxel_types[MAX_VOXEL_TYPES];
 	int _atlas_size;
 
+	uint8_t _baked_transparent[MAX_VOXEL_TYPES];
+	uint8_t _baked_hidden_faces[MAX_VOXEL_TYPES];
+	uint8_t _baked_material_id[MAX_VOXEL_TYPES];
+	uint8_t _baked_geometry[MAX_VOXEL_TYPES];
+
 };
 
 #endif // VOXEL_LIBRARY_H
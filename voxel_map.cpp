@@ -1,4 +1,5 @@
 #include "voxel_map.h"
+#include "voxel_connectivity.h"
 #include "core/os/os.h"
 
 //----------------------------------------------------------------------------
@@ -14,6 +15,35 @@ MeshInstance * VoxelBlock::get_mesh_instance(const Node & root) {
 	return n->cast_to<MeshInstance>();
 }
 
+VoxelBuffer & VoxelBlock::get_voxels_for_write() {
+	if (voxels->reference_get_count() > 1) {
+		// Copy on write
+		Ref<VoxelBuffer> copy(memnew(VoxelBuffer));
+		const Vector3i size = voxels->get_size();
+		copy->create(size.x, size.y, size.z);
+		for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+			copy->copy_from(**voxels, i);
+		}
+		voxels = copy;
+	}
+	modified = true;
+	_uniform_voxel_valid = false;
+	return **voxels;
+}
+
+void VoxelBlock::set_voxels(Ref<VoxelBuffer> buffer) {
+	voxels = buffer;
+	_uniform_voxel_valid = false;
+}
+
+int VoxelBlock::get_uniform_voxel() {
+	if (!_uniform_voxel_valid) {
+		_uniform_voxel = voxels->is_uniform(0) ? voxels->get_voxel(0, 0, 0, 0) : -1;
+		_uniform_voxel_valid = true;
+	}
+	return _uniform_voxel;
+}
+
 // Helper
 VoxelBlock * VoxelBlock::create(Vector3i bpos, Ref<VoxelBuffer> buffer) {
 	const int bs = VoxelBlock::SIZE;
@@ -23,19 +53,21 @@ VoxelBlock * VoxelBlock::create(Vector3i bpos, Ref<VoxelBuffer> buffer) {
 	VoxelBlock * block = memnew(VoxelBlock);
 	block->pos = bpos;
 
-	block->voxels = buffer;
+	block->set_voxels(buffer);
 	//block->map = &map;
 	return block;
 }
 
-VoxelBlock::VoxelBlock(): voxels(NULL) {
+VoxelBlock::VoxelBlock(): voxels(NULL), mesh_memory(0), modified(false),
+	connectivity(VoxelConnectivity::ALL), occluded(false), occlusion_visit(0),
+	_uniform_voxel(-1), _uniform_voxel_valid(false) {
 }
 
 //----------------------------------------------------------------------------
 // VoxelMap
 //----------------------------------------------------------------------------
 
-VoxelMap::VoxelMap() : _last_accessed_block(NULL) {
+VoxelMap::VoxelMap() : _last_accessed_block(NULL), _observer(NULL) {
 	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
 		_default_voxel[i] = 0;
 	}
@@ -70,7 +102,11 @@ void VoxelMap::set_voxel(int value, Vector3i pos, unsigned int c) {
 		set_block(bpos, block);
 	}
 
-	block->voxels->set_voxel(value, pos - block_to_voxel(bpos), c);
+	block->get_voxels_for_write().set_voxel(value, pos - block_to_voxel(bpos), c);
+
+	if (_observer) {
+		_observer->voxel_changed(pos);
+	}
 }
 
 void VoxelMap::set_default_voxel(int value, unsigned int channel) {
@@ -111,7 +147,8 @@ void VoxelMap::set_block_buffer(Vector3i bpos, Ref<VoxelBuffer> buffer) {
 		set_block(bpos, block);
 	}
 	else {
-		block->voxels = buffer;
+		block->set_voxels(buffer);
+		block->modified = true;
 	}
 }
 
@@ -197,6 +234,56 @@ void VoxelMap::get_buffer_copy(Vector3i min_pos, VoxelBuffer & dst_buffer, unsig
 	}
 }
 
+void VoxelMap::get_neighborhood(Vector3i bpos, Ref<VoxelBuffer> out_blocks[27]) {
+	unsigned int i = 0;
+	Vector3i d;
+	for (d.z = -1; d.z < 2; ++d.z) {
+		for (d.x = -1; d.x < 2; ++d.x) {
+			for (d.y = -1; d.y < 2; ++d.y) {
+				VoxelBlock * block = get_block(bpos + d);
+				if (block) {
+					out_blocks[i] = block->voxels;
+				}
+				else {
+					out_blocks[i] = Ref<VoxelBuffer>();
+				}
+				++i;
+			}
+		}
+	}
+}
+
+void VoxelMap::get_neighborhood_copy(const Ref<VoxelBuffer> blocks[27], int default_value, VoxelBuffer & dst_buffer, unsigned int channel) {
+	ERR_FAIL_INDEX(channel, VoxelBuffer::MAX_CHANNELS);
+
+	const int bs = VoxelBlock::SIZE;
+	ERR_FAIL_COND(!(dst_buffer.get_size() == Vector3i(bs + 2, bs + 2, bs + 2)));
+
+	// Coordinates are relative to the origin of the central block
+	const Vector3i min_pos(-1, -1, -1);
+	const Vector3i max_pos = min_pos + dst_buffer.get_size();
+
+	unsigned int i = 0;
+	Vector3i d;
+	for (d.z = -1; d.z < 2; ++d.z) {
+		for (d.x = -1; d.x < 2; ++d.x) {
+			for (d.y = -1; d.y < 2; ++d.y) {
+
+				Vector3i offset = d * bs;
+				const Ref<VoxelBuffer> & src = blocks[i++];
+
+				if (src.is_valid()) {
+					// Note: copy_from takes care of clamping the area if it's on an edge
+					dst_buffer.copy_from(**src, min_pos - offset, max_pos - offset, offset - min_pos, channel);
+				}
+				else {
+					dst_buffer.fill_area(default_value, offset - min_pos, offset - min_pos + Vector3i(bs, bs, bs), channel);
+				}
+			}
+		}
+	}
+}
+
 void VoxelMap::remove_blocks_not_in_area(Vector3i min, Vector3i max) {
 
 	Vector3i::sort_min_max(min, max);
@@ -226,6 +313,19 @@ void VoxelMap::remove_blocks_not_in_area(Vector3i min, Vector3i max) {
 	}
 }
 
+void VoxelMap::remove_block(Vector3i bpos) {
+	VoxelBlock ** p = _blocks.getptr(bpos);
+	if (p == NULL) {
+		return;
+	}
+	VoxelBlock * block = *p;
+	if (block == _last_accessed_block) {
+		_last_accessed_block = NULL;
+	}
+	_blocks.erase(bpos);
+	memdelete(block);
+}
+
 void VoxelMap::clear() {
 	const Vector3i * key = NULL;
 	while (key = _blocks.next(key)) {
@@ -17,14 +17,50 @@ public:
 	Ref<VoxelBuffer> voxels; // SIZE*SIZE*SIZE voxels
 	Vector3i pos;
 	NodePath mesh_instance_path;
+	// Used instead of a MeshInstance when the terrain renders through the VisualServer
+	RID instance_rid;
+	RID mesh_rid;
+	// Estimated size of its mesh, for statistics
+	int mesh_memory;
+	// Static body holding the collision shapes of the block, if it has any
+	RID collision_body;
+	bool modified; // Voxels changed since the block was loaded, so they need to be saved
+
+	// Which faces of the block see each other, as computed by VoxelConnectivity when it was last meshed
+	uint16_t connectivity;
+	// Hidden because the camera can't see it through other blocks
+	bool occluded;
+	// Last visit by the occlusion culling search of the terrain
+	uint32_t occlusion_visit;
 
 	static VoxelBlock * create(Vector3i bpos, Ref<VoxelBuffer> buffer);
 
 	MeshInstance * get_mesh_instance(const Node & root);
 
+	// Returns voxels ready to be modified, and marks the block as modified.
+	// If they are still referenced by a background task, they get copied first so the task keeps reading consistent data.
+	VoxelBuffer & get_voxels_for_write();
+
+	void set_voxels(Ref<VoxelBuffer> buffer);
+
+	// Value of all voxels of channel 0 if they are the same, -1 otherwise.
+	// It requires going through all voxels, so the result is kept until they are modified.
+	int get_uniform_voxel();
+
 private:
 	VoxelBlock();
 
+	int _uniform_voxel;
+	bool _uniform_voxel_valid;
+
+};
+
+
+// Receives modifications made to a VoxelMap
+class IVoxelMapObserver {
+public:
+	virtual ~IVoxelMapObserver() {}
+	virtual void voxel_changed(Vector3i pos) = 0;
 };
 
 
@@ -58,10 +94,19 @@ public:
 	// Gets a copy of all voxels in the area starting at min_pos having the same size as dst_buffer.
 	void get_buffer_copy(Vector3i min_pos, VoxelBuffer & dst_buffer, unsigned int channel = 0);
 
+	// Gets references to the voxels of the 3x3x3 blocks centered on bpos, in the same [z][x][y] order as voxels.
+	// Missing blocks are left null.
+	void get_neighborhood(Vector3i bpos, Ref<VoxelBuffer> out_blocks[27]);
+
+	// Same as get_buffer_copy() for the block at the center of a neighborhood, padded by one voxel.
+	// It only reads the given buffers so it can be used from a worker thread.
+	static void get_neighborhood_copy(const Ref<VoxelBuffer> blocks[27], int default_value, VoxelBuffer & dst_buffer, unsigned int channel = 0);
+
 	// Moves the given buffer into a block of the map. The buffer is referenced, no copy is made.
 	void set_block_buffer(Vector3i bpos, Ref<VoxelBuffer> buffer);
 
 	void remove_blocks_not_in_area(Vector3i min, Vector3i max);
+	void remove_block(Vector3i bpos);
 
 	VoxelBlock * get_block(Vector3i bpos);
 
@@ -71,6 +116,18 @@ public:
 	void clear();
 
 	void set_block(Vector3i bpos, VoxelBlock * block);
+
+	// Calls action(VoxelBlock*) for every block, in no particular order
+	template <typename A>
+	void for_all_blocks(A & action) {
+		const Vector3i * key = NULL;
+		while ((key = _blocks.next(key))) {
+			action(_blocks.get(*key));
+		}
+	}
+
+	// Notified when voxels are modified with set_voxel()
+	void set_observer(IVoxelMapObserver * observer) { _observer = observer; }
 private:
 	_FORCE_INLINE_ int get_block_size() const { return VoxelBlock::SIZE; }
 
@@ -99,6 +156,8 @@ private:
 	// To prevent too much hashing, this reference is checked before.
 	VoxelBlock * _last_accessed_block;
 
+	IVoxelMapObserver * _observer;
+
 };
 
 #endif // VOXEL_MAP_H
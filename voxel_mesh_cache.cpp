@@ -0,0 +1,50 @@
+#include "voxel_mesh_cache.h"
+
+VoxelMeshCache::VoxelMeshCache() {
+	_mutex = Mutex::create();
+}
+
+VoxelMeshCache::~VoxelMeshCache() {
+	memdelete(_mutex);
+}
+
+bool VoxelMeshCache::get(uint64_t hash, uint64_t check, Entry & out_entry) const {
+	_mutex->lock();
+	const Entry * entry = _entries.getptr(hash);
+	bool found = entry != NULL && entry->check == check;
+	if (found) {
+		out_entry = *entry;
+	}
+	_mutex->unlock();
+	return found;
+}
+
+void VoxelMeshCache::set(uint64_t hash, const Entry & entry) {
+	_mutex->lock();
+
+	if (!_entries.has(hash)) {
+		_order.push_back(hash);
+	}
+	_entries.set(hash, entry);
+
+	if (_order.size() > MAX_ENTRIES) {
+		_entries.erase(_order[0]);
+		_order.remove(0);
+	}
+
+	_mutex->unlock();
+}
+
+void VoxelMeshCache::clear() {
+	_mutex->lock();
+	_entries.clear();
+	_order.clear();
+	_mutex->unlock();
+}
+
+int VoxelMeshCache::get_size() const {
+	_mutex->lock();
+	int size = _entries.size();
+	_mutex->unlock();
+	return size;
+}
@@ -0,0 +1,43 @@
+#ifndef VOXEL_MESH_CACHE_H
+#define VOXEL_MESH_CACHE_H
+
+#include <os/mutex.h>
+#include <core/hash_map.h>
+#include <scene/resources/mesh.h>
+
+// Meshes of the last blocks built, by hash of the voxels they were built from (see VoxelNeighborhood::get_hashes()).
+// Generated terrain has many identical blocks, like flat ground, which can share the same mesh instead of
+// being meshed and uploaded again. Worker threads look meshes up, the main thread adds them.
+class VoxelMeshCache {
+public:
+	// Oldest meshes are forgotten past this count. Blocks showing them keep them alive.
+	static const int MAX_ENTRIES = 256;
+
+	struct Entry {
+		uint64_t check;
+		Ref<Mesh> mesh;
+		uint16_t connectivity;
+		int memory;
+		int vertex_count;
+
+		Entry() : check(0), connectivity(0), memory(0), vertex_count(0) {}
+	};
+
+	VoxelMeshCache();
+	~VoxelMeshCache();
+
+	// Thread-safe
+	bool get(uint64_t hash, uint64_t check, Entry & out_entry) const;
+
+	void set(uint64_t hash, const Entry & entry);
+	void clear();
+	int get_size() const;
+
+private:
+	Mutex * _mutex;
+	HashMap<uint64_t, Entry> _entries;
+	// Oldest first
+	Vector<uint64_t> _order;
+};
+
+#endif // VOXEL_MESH_CACHE_H
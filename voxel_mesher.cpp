@@ -1,5 +1,6 @@
 #include "voxel_mesher.h"
 #include "voxel_library.h"
+#include <servers/visual_server.h>
 
 
 // The following tables respect the following conventions
@@ -128,10 +129,36 @@ static const unsigned int g_edge_corners[EDGE_COUNT][2] = {
     { 4, 5 }, { 5, 6 }, { 6, 7 }, {7, 4}
 };
 
+// Occlusion of the 4 corners of a cube face, 2 bits each in the order of g_side_corners,
+// indexed by which of the 8 voxels around the face are opaque:
+// bit j for the edge g_side_edges[side][j], which touches corners j and j+1,
+// and bit 4+j for the voxel at the corner j.
+static const uint8_t g_cube_face_occlusion[256] = {
+    0x00, 0x05, 0x14, 0x1d, 0x50, 0x55, 0x74, 0x7d, 0x41, 0x47, 0x55, 0x5f, 0xd1, 0xd7, 0xf5, 0xff,
+    0x01, 0x06, 0x15, 0x1e, 0x51, 0x56, 0x75, 0x7e, 0x42, 0x47, 0x56, 0x5f, 0xd2, 0xd7, 0xf6, 0xff,
+    0x04, 0x09, 0x18, 0x1d, 0x54, 0x59, 0x78, 0x7d, 0x45, 0x4b, 0x59, 0x5f, 0xd5, 0xdb, 0xf9, 0xff,
+    0x05, 0x0a, 0x19, 0x1e, 0x55, 0x5a, 0x79, 0x7e, 0x46, 0x4b, 0x5a, 0x5f, 0xd6, 0xdb, 0xfa, 0xff,
+    0x10, 0x15, 0x24, 0x2d, 0x60, 0x65, 0x74, 0x7d, 0x51, 0x57, 0x65, 0x6f, 0xe1, 0xe7, 0xf5, 0xff,
+    0x11, 0x16, 0x25, 0x2e, 0x61, 0x66, 0x75, 0x7e, 0x52, 0x57, 0x66, 0x6f, 0xe2, 0xe7, 0xf6, 0xff,
+    0x14, 0x19, 0x28, 0x2d, 0x64, 0x69, 0x78, 0x7d, 0x55, 0x5b, 0x69, 0x6f, 0xe5, 0xeb, 0xf9, 0xff,
+    0x15, 0x1a, 0x29, 0x2e, 0x65, 0x6a, 0x79, 0x7e, 0x56, 0x5b, 0x6a, 0x6f, 0xe6, 0xeb, 0xfa, 0xff,
+    0x40, 0x45, 0x54, 0x5d, 0x90, 0x95, 0xb4, 0xbd, 0x81, 0x87, 0x95, 0x9f, 0xd1, 0xd7, 0xf5, 0xff,
+    0x41, 0x46, 0x55, 0x5e, 0x91, 0x96, 0xb5, 0xbe, 0x82, 0x87, 0x96, 0x9f, 0xd2, 0xd7, 0xf6, 0xff,
+    0x44, 0x49, 0x58, 0x5d, 0x94, 0x99, 0xb8, 0xbd, 0x85, 0x8b, 0x99, 0x9f, 0xd5, 0xdb, 0xf9, 0xff,
+    0x45, 0x4a, 0x59, 0x5e, 0x95, 0x9a, 0xb9, 0xbe, 0x86, 0x8b, 0x9a, 0x9f, 0xd6, 0xdb, 0xfa, 0xff,
+    0x50, 0x55, 0x64, 0x6d, 0xa0, 0xa5, 0xb4, 0xbd, 0x91, 0x97, 0xa5, 0xaf, 0xe1, 0xe7, 0xf5, 0xff,
+    0x51, 0x56, 0x65, 0x6e, 0xa1, 0xa6, 0xb5, 0xbe, 0x92, 0x97, 0xa6, 0xaf, 0xe2, 0xe7, 0xf6, 0xff,
+    0x54, 0x59, 0x68, 0x6d, 0xa4, 0xa9, 0xb8, 0xbd, 0x95, 0x9b, 0xa9, 0xaf, 0xe5, 0xeb, 0xf9, 0xff,
+    0x55, 0x5a, 0x69, 0x6e, 0xa5, 0xaa, 0xb9, 0xbe, 0x96, 0x9b, 0xaa, 0xaf, 0xe6, 0xeb, 0xfa, 0xff,
+};
+
 
 VoxelMesher::VoxelMesher():
 	_baked_occlusion_darkness(0.75),
 	_bake_occlusion(true),
+	_greedy_meshing(false),
+	_bitmask_culling(true),
+	_compact_vertices(false),
 	_randomize_corners(false),
 	_randomize_factor(Vector3 (0, 0, 0))
 {}
@@ -144,7 +171,6 @@ void VoxelMesher::set_library(Ref<VoxelLibrary> library) {
 void VoxelMesher::set_material(Ref<Material> material, unsigned int id) {
     ERR_FAIL_COND(id >= MAX_MATERIALS);
     _materials[id] = material;
-    _surface_tool[id].set_material(material);
 }
 
 Ref<Material> VoxelMesher::get_material(unsigned int id) const {
@@ -166,20 +192,24 @@ void VoxelMesher::set_occlusion_enabled(bool enable) {
 
 inline Color Color_greyscale(float c) { return Color(c, c, c); }
 
-inline bool is_face_visible(const VoxelLibrary & lib, const Voxel & vt, int other_voxel_id, int other_face) {
-    //if (other_voxel_id == 0) // air
-    //    return true;
-    if (lib.has_voxel(other_voxel_id)) {
-        const Voxel & other_vt = lib.get_voxel_const(other_voxel_id);
-        return (other_vt.is_transparent() && vt.get_id() != other_voxel_id) || !other_vt.is_face_visible(other_face);
-    }
-    return true;
+// These use baked properties of the library, missing voxels are transparent
+inline bool is_face_visible(const VoxelLibrary & lib, int voxel_id, int other_voxel_id, int other_face) {
+    return (lib.get_baked_transparent(other_voxel_id) && voxel_id != other_voxel_id)
+            || (lib.get_baked_hidden_faces(other_voxel_id) & (1 << other_face));
 }
 
 inline bool is_transparent(const VoxelLibrary & lib, int voxel_id) {
-    if (lib.has_voxel(voxel_id))
-        return lib.get_voxel_const(voxel_id).is_transparent();
-    return true;
+    return lib.get_baked_transparent(voxel_id);
+}
+
+uint64_t VoxelMesher::get_settings_hash() const {
+    uint64_t hash = hash_djb2_one_64(_library.is_valid() ? _library->get_instance_ID() : 0);
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        hash = hash_djb2_one_64(_materials[i].is_valid() ? _materials[i]->get_instance_ID() : 0, hash);
+    }
+    hash = hash_djb2_one_64(_bake_occlusion ? Math::floor(_baked_occlusion_darkness * 1000.f + 0.5) + 1 : 0, hash);
+    hash = hash_djb2_one_64(_greedy_meshing, hash);
+    return hash_djb2_one_64(_compact_vertices, hash);
 }
 
 Ref<Mesh> VoxelMesher::build_ref(Ref<VoxelBuffer> buffer_ref, unsigned int channel_number) {
@@ -190,175 +220,907 @@ Ref<Mesh> VoxelMesher::build_ref(Ref<VoxelBuffer> buffer_ref, unsigned int chann
 Ref<Mesh> VoxelMesher::build(const VoxelBuffer & buffer, unsigned int channel_number) {
     ERR_FAIL_COND_V(_library.is_null(), Ref<Mesh>());
 
-    const VoxelLibrary & library = **_library;
+    // Surfaces are indexed as they get filled, so they go to the mesh without going through SurfaceTool
+    Output output;
+    build_arrays(buffer, channel_number, output);
+    return commit(output);
+}
+
+void VoxelMesher::Surface::clear() {
+    positions.clear();
+    normals.clear();
+    uvs.clear();
+    colors.clear();
+    uv2s.clear();
+    indices.clear();
+    _has_color = false;
+    _has_uv2 = false;
+    _vertex_count = 0;
+    _index_count = 0;
+}
+
+void VoxelMesher::Surface::reset() {
+    _has_color = false;
+    _has_uv2 = false;
+    _vertex_count = 0;
+    _index_count = 0;
+}
+
+template <typename T>
+static void copy_attribute(const Vector<T> & src, int count, Vector<T> & dst) {
+    dst.resize(count);
+    for (int i = 0; i < count; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+void VoxelMesher::Surface::copy_to(Surface & other) const {
+    other.clear();
+    copy_attribute(positions, _vertex_count, other.positions);
+    copy_attribute(normals, _vertex_count, other.normals);
+    copy_attribute(uvs, _vertex_count, other.uvs);
+    if (_has_color)
+        copy_attribute(colors, _vertex_count, other.colors);
+    if (_has_uv2)
+        copy_attribute(uv2s, _vertex_count, other.uv2s);
+    copy_attribute(indices, _index_count, other.indices);
+    other._has_color = _has_color;
+    other._has_uv2 = _has_uv2;
+    other._vertex_count = _vertex_count;
+    other._index_count = _index_count;
+}
+
+void VoxelMesher::Surface::grow(int vertex_count, int index_count) {
+    if (_vertex_count + vertex_count > positions.size()) {
+        const int capacity = MAX(_vertex_count + vertex_count, positions.size() * 2);
+        positions.resize(capacity);
+        normals.resize(capacity);
+        uvs.resize(capacity);
+        if (_has_color)
+            colors.resize(capacity);
+        if (_has_uv2)
+            uv2s.resize(capacity);
+    }
+    if (_index_count + index_count > indices.size()) {
+        indices.resize(MAX(_index_count + index_count, indices.size() * 2));
+    }
+}
+
+void VoxelMesher::Surface::finish() {
+    positions.resize(_vertex_count);
+    normals.resize(_vertex_count);
+    uvs.resize(_vertex_count);
+    if (_has_color)
+        colors.resize(_vertex_count);
+    if (_has_uv2)
+        uv2s.resize(_vertex_count);
+    indices.resize(_index_count);
+}
+
+void VoxelMesher::Surface::pack_normals() {
+    // Without colors, adding them would take more than the normals
+    if (positions.size() == 0 || colors.size() == 0) {
+        return;
+    }
+    for (int i = 0; i < normals.size(); ++i) {
+        const Vector3 n = normals[i];
+        const Vector3 a(Math::abs(n.x), Math::abs(n.y), Math::abs(n.z));
+        int side;
+        if (a.x >= a.y && a.x >= a.z) {
+            side = n.x < 0 ? Voxel::SIDE_LEFT : Voxel::SIDE_RIGHT;
+        }
+        else if (a.y >= a.z) {
+            side = n.y < 0 ? Voxel::SIDE_BOTTOM : Voxel::SIDE_TOP;
+        }
+        else {
+            side = n.z < 0 ? Voxel::SIDE_BACK : Voxel::SIDE_FRONT;
+        }
+        colors[i] = Color(colors[i].r, static_cast<float>(side) / 5.f, 0, 1);
+    }
+    normals.clear();
+}
+
+// Appends src after the first base elements of dst. An optional array missing on one side is filled with value.
+template <typename T>
+static void append_attribute(Vector<T> & dst, int base, const Vector<T> & src, int count, const T & value) {
+    if (dst.size() == 0 && src.size() == 0) {
+        return;
+    }
+    int i = dst.size();
+    dst.resize(base + count);
+    for (; i < base; ++i) {
+        dst[i] = value;
+    }
+    for (int j = 0; j < count; ++j) {
+        dst[base + j] = j < src.size() ? src[j] : value;
+    }
+}
+
+void VoxelMesher::Surface::append(const Surface & other) {
+    const int count = other.positions.size();
+    if (count == 0) {
+        return;
+    }
+    const int base = positions.size();
+
+    append_attribute(positions, base, other.positions, count, Vector3());
+    append_attribute(normals, base, other.normals, count, Vector3());
+    append_attribute(uvs, base, other.uvs, count, Vector2());
+    append_attribute(colors, base, other.colors, count, Color(1, 1, 1));
+    append_attribute(uv2s, base, other.uv2s, count, Vector2());
+
+    const int index_base = indices.size();
+    indices.resize(index_base + other.indices.size());
+    for (int i = 0; i < other.indices.size(); ++i) {
+        indices[index_base + i] = base + other.indices[i];
+    }
+
+    _vertex_count = positions.size();
+    _index_count = indices.size();
+    _has_color = colors.size() != 0;
+    _has_uv2 = uv2s.size() != 0;
+}
+
+int VoxelMesher::Output::get_vertex_count() const {
+    int count = 0;
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        count += surfaces[i].positions.size();
+    }
+    return count;
+}
+
+int VoxelMesher::Output::get_memory_usage() const {
+    int size = 0;
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        const Surface & surface = surfaces[i];
+        size += surface.positions.size() * sizeof(Vector3);
+        size += surface.normals.size() * sizeof(Vector3);
+        size += surface.uvs.size() * sizeof(Vector2);
+        size += surface.colors.size() * sizeof(Color);
+        size += surface.uv2s.size() * sizeof(Vector2);
+        size += surface.indices.size() * sizeof(int);
+    }
+    return size;
+}
+
+void VoxelMesher::build_arrays(const VoxelBuffer & buffer, unsigned int channel_number, Output & output, Scratch & scratch) const {
+    build_output(buffer, channel_number, output, scratch);
+}
+
+void VoxelMesher::build_arrays(const VoxelNeighborhood & neighborhood, unsigned int channel_number, Output & output, Scratch & scratch) const {
+    build_output(neighborhood, channel_number, output, scratch);
+}
+
+template <typename Voxels_T>
+void VoxelMesher::build_output(const Voxels_T & buffer, unsigned int channel_number, Output & output, Scratch & scratch) const {
+    ERR_FAIL_COND(_library.is_null());
+
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        scratch.surfaces[i].reset();
+    }
+
+    build_surfaces(buffer, channel_number, scratch.surfaces, scratch, 0, buffer.get_size().y - 2);
+
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        scratch.surfaces[i].copy_to(output.surfaces[i]);
+    }
+
+    if (_compact_vertices) {
+        for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+            output.surfaces[i].pack_normals();
+        }
+    }
+}
+
+void VoxelMesher::build_slabs(const VoxelBuffer & buffer, unsigned int channel_number, Vector<Output> & slabs, uint32_t dirty_slabs, Scratch & scratch) const {
+    build_slabs_output(buffer, channel_number, slabs, dirty_slabs, scratch);
+}
+
+void VoxelMesher::build_slabs(const VoxelNeighborhood & neighborhood, unsigned int channel_number, Vector<Output> & slabs, uint32_t dirty_slabs, Scratch & scratch) const {
+    build_slabs_output(neighborhood, channel_number, slabs, dirty_slabs, scratch);
+}
+
+template <typename Voxels_T>
+void VoxelMesher::build_slabs_output(const Voxels_T & buffer, unsigned int channel_number, Vector<Output> & slabs, uint32_t dirty_slabs, Scratch & scratch) const {
+    ERR_FAIL_COND(_library.is_null());
+
+    const int height = buffer.get_size().y - 2;
+    const int slab_count = (height + SLAB_HEIGHT - 1) / SLAB_HEIGHT;
+    ERR_FAIL_COND(slab_count > 32);
+
+    if (slabs.size() != slab_count) {
+        slabs.resize(slab_count);
+        dirty_slabs = ALL_SLABS;
+    }
+
+    for (int slab_index = 0; slab_index < slab_count; ++slab_index) {
+        if ((dirty_slabs & (uint32_t(1) << slab_index)) == 0) {
+            continue;
+        }
+
+        // Faces never cross slabs, and voxels next to a slab are only read to cull and shade its faces
+        Output & slab = slabs[slab_index];
+        for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+            scratch.surfaces[i].reset();
+        }
+
+        const int min_y = slab_index * SLAB_HEIGHT;
+        build_surfaces(buffer, channel_number, scratch.surfaces, scratch, min_y, MIN(min_y + SLAB_HEIGHT, height));
+
+        for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+            scratch.surfaces[i].copy_to(slab.surfaces[i]);
+        }
+
+        if (_compact_vertices) {
+            for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+                slab.surfaces[i].pack_normals();
+            }
+        }
+    }
+}
+
+void VoxelMesher::merge_slabs(const Vector<Output> & slabs, Output & output) {
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        Surface & surface = output.surfaces[i];
+        surface.clear();
+        for (int slab_index = 0; slab_index < slabs.size(); ++slab_index) {
+            surface.append(slabs[slab_index].surfaces[i]);
+        }
+    }
+}
+
+uint32_t VoxelMesher::get_slabs_in_range(int min_y, int max_y) {
+    min_y = MAX(min_y, 0);
+    if (max_y < min_y) {
+        return 0;
+    }
+    uint32_t slabs = 0;
+    for (int i = min_y / SLAB_HEIGHT; i <= max_y / SLAB_HEIGHT && i < 32; ++i) {
+        slabs |= uint32_t(1) << i;
+    }
+    return slabs;
+}
+
+void VoxelMesher::build_arrays(const VoxelBuffer & buffer, unsigned int channel_number, Output & output) const {
+    Scratch scratch;
+    build_arrays(buffer, channel_number, output, scratch);
+}
+
+template <typename T>
+static DVector<T> to_dvector(const Vector<T> & src) {
+    DVector<T> dst;
+    dst.resize(src.size());
+    typename DVector<T>::Write w = dst.write();
+    for (int i = 0; i < src.size(); ++i) {
+        w[i] = src[i];
+    }
+    return dst;
+}
+
+static Array make_surface_arrays(const VoxelMesher::Surface & surface) {
+    Array arrays;
+    arrays.resize(Mesh::ARRAY_MAX);
+    arrays[Mesh::ARRAY_VERTEX] = to_dvector(surface.positions);
+    if (surface.normals.size() != 0)
+        arrays[Mesh::ARRAY_NORMAL] = to_dvector(surface.normals);
+    arrays[Mesh::ARRAY_TEX_UV] = to_dvector(surface.uvs);
+    if (surface.colors.size() != 0)
+        arrays[Mesh::ARRAY_COLOR] = to_dvector(surface.colors);
+    if (surface.uv2s.size() != 0)
+        arrays[Mesh::ARRAY_TEX_UV2] = to_dvector(surface.uv2s);
+    arrays[Mesh::ARRAY_INDEX] = to_dvector(surface.indices);
+    return arrays;
+}
+
+Ref<Mesh> VoxelMesher::commit(const Output & output) const {
+
+    int count_valid_materials = 0;
+    Ref<Mesh> mesh_ref(memnew(Mesh));
+
+    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+        if (_materials[i].is_valid()) {
+            count_valid_materials++;
+            const Surface & surface = output.surfaces[i];
+            if (surface.positions.size() == 0)
+                continue;
+
+            mesh_ref->add_surface(Mesh::PRIMITIVE_TRIANGLES, make_surface_arrays(surface));
+            mesh_ref->surface_set_material(mesh_ref->get_surface_count() - 1, _materials[i]);
+        }
+    }
+
+    ERR_FAIL_COND_V(count_valid_materials == 0, Ref<Mesh>());
+
+    return mesh_ref;
+}
+
+void VoxelMesher::commit(const Output & output, RID mesh) const {
+    ERR_FAIL_COND(!mesh.is_valid());
+
+    VisualServer & vs = *VisualServer::get_singleton();
+
+    for (int i = vs.mesh_get_surface_count(mesh) - 1; i >= 0; --i) {
+        vs.mesh_remove_surface(mesh, i);
+    }
 
     for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
-        _surface_tool[i].begin(Mesh::PRIMITIVE_TRIANGLES);
+        if (_materials[i].is_valid()) {
+            const Surface & surface = output.surfaces[i];
+            if (surface.positions.size() == 0)
+                continue;
+
+            vs.mesh_add_surface(mesh, VisualServer::PRIMITIVE_TRIANGLES, make_surface_arrays(surface));
+            vs.mesh_surface_set_material(mesh, vs.mesh_get_surface_count(mesh) - 1, _materials[i]->get_rid());
+        }
     }
+}
 
-    float baked_occlusion_darkness;
-    if (_bake_occlusion)
-        baked_occlusion_darkness = _baked_occlusion_darkness / 3.0;
+template <typename Voxels_T>
+void VoxelMesher::build_surfaces(const Voxels_T & buffer, unsigned int channel_number, Surface * surfaces, Scratch & scratch, int min_y, int max_y) const {
 
     // The technique is Culled faces.
-    // Could be improved with greedy meshing: https://0fps.net/2012/06/30/meshing-in-a-minecraft-game/
-    // However I don't feel it's worth it yet:
-    // - Not so much gain for organic worlds with lots of texture variations
-    // - Works well with cubes but not with any shape
-    // - Slower
-    // => Could be implemented in a separate class?
+    // With greedy meshing (https://0fps.net/2012/06/30/meshing-in-a-minecraft-game/), visible faces of cubes
+    // are not emitted right away but written in one mask per side, which are merged into quads at the end.
+    // Faces of other shapes, or with occlusion varying across them, are still emitted one by one.
 
     // Iterate 3D padded data to extract voxel faces.
     // This is the most intensive job in this class, so all required data should be as fit as possible.
     const Vector3i buffer_size = buffer.get_size();
-    for (unsigned int z = 1; z < buffer_size.z-1; ++z) {
-        for (unsigned int x = 1; x < buffer_size.x-1; ++x) {
-            for (unsigned int y = 1; y < buffer_size.y-1; ++y) {
+    const Vector3i inner_size(buffer_size.x - 2, buffer_size.y - 2, buffer_size.z - 2);
+
+    // Per side, 0 where there is no face to merge, or (voxel_id + 1) << 2 | occlusion. Same [z][x][y] order as voxels.
+    // Resizing to the same size doesn't reallocate.
+    Vector<uint32_t> * side_masks = scratch.side_masks;
+    if (_greedy_meshing) {
+        const int volume = inner_size.x * inner_size.y * inner_size.z;
+        for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+            Vector<uint32_t> & mask = side_masks[side];
+            mask.resize(volume);
+            for (int i = 0; i < volume; ++i) {
+                mask[i] = 0;
+            }
+        }
+    }
 
-                int voxel_id = buffer.get_voxel(x, y, z, channel_number);
+    if (_bitmask_culling && buffer_size.y <= 64) {
+        build_faces_bitmask(buffer, channel_number, surfaces, scratch, min_y, max_y);
+    }
+    else {
+        const VoxelLibrary & library = **_library;
 
-                if (library.has_voxel(voxel_id)) {
+        for (unsigned int z = 1; z < buffer_size.z-1; ++z) {
+            for (unsigned int x = 1; x < buffer_size.x-1; ++x) {
+                for (unsigned int y = 1 + min_y; y < 1 + max_y; ++y) {
 
-                    const Voxel & voxel = library.get_voxel_const(voxel_id);
+                    int voxel_id = buffer.get_voxel(x, y, z, channel_number);
 
-                    SurfaceTool & st = _surface_tool[voxel.get_material_id()];
+                    if (library.get_baked_geometry(voxel_id) != VoxelLibrary::GEOMETRY_NONE) {
+                        add_voxel(buffer, channel_number, x, y, z, voxel_id, surfaces, side_masks);
+                    }
+                }
+            }
+        }
+    }
 
-                    // Hybrid approach: extract cube faces and decimate those that aren't visible,
-                    // and still allow voxels to have geometry that is not a cube
+    if (_greedy_meshing) {
+        build_greedy_quads(side_masks, inner_size, surfaces);
+    }
+}
 
-                    // Sides
-                    for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+static _FORCE_INLINE_ unsigned int get_lowest_bit_index(uint64_t bits) {
+#ifdef __GNUC__
+    return __builtin_ctzll(bits);
+#else
+    unsigned int i = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
 
-                    	if(!voxel.is_face_visible(side)) {
-                    		continue;
-                    	}
-
-                        const DVector<Vector3> & vertices = voxel.get_model_side_vertices(side);
-                        if (vertices.size() != 0) {
-
-                            Vector3i normal = g_side_normals[side];
-                            unsigned nx = x + normal.x;
-                            unsigned ny = y + normal.y;
-                            unsigned nz = z + normal.z;
-
-                            int neighbor_voxel_id = buffer.get_voxel(nx, ny, nz, channel_number);
-                            // TODO Better face visibility test
-                            if (is_face_visible(library, voxel, neighbor_voxel_id, Voxel::opposite(side))) {
-
-                                // The face is visible
-
-                                int shaded_corner[8] = { 0 };
-
-                                if (_bake_occlusion) {
-
-                                    // Combinatory solution for https://0fps.net/2013/07/03/ambient-occlusion-for-minecraft-like-worlds/
-
-                                    for (unsigned int j = 0; j < 4; ++j) {
-                                        unsigned int edge = g_side_edges[side][j];
-                                        Vector3i edge_normal = g_edge_inormals[edge];
-                                        unsigned ex = x + edge_normal.x;
-                                        unsigned ey = y + edge_normal.y;
-                                        unsigned ez = z + edge_normal.z;
-                                        if (!is_transparent(library, buffer.get_voxel(ex, ey, ez))) {
-                                            shaded_corner[g_edge_corners[edge][0]] += 1;
-                                            shaded_corner[g_edge_corners[edge][1]] += 1;
-                                        }
-                                    }
-                                    for (unsigned int j = 0; j < 4; ++j) {
-                                        unsigned int corner = g_side_corners[side][j];
-                                        if (shaded_corner[corner] == 2) {
-                                            shaded_corner[corner] = 3;
-                                        }
-                                        else {
-                                            Vector3i corner_normal = g_corner_inormals[corner];
-                                            unsigned int cx = x + corner_normal.x;
-                                            unsigned int cy = y + corner_normal.y;
-                                            unsigned int cz = z + corner_normal.z;
-                                            if (!is_transparent(library, buffer.get_voxel(cx, cy, cz))) {
-                                                shaded_corner[corner] += 1;
-                                            }
-                                        }
-                                    }
-                                }
-
-                                DVector<Vector3>::Read rv = vertices.read();
-                                DVector<Vector2>::Read rt = voxel.get_model_side_uv(side).read();
-                                Vector3 pos(x - 1, y - 1, z - 1);
-
-                                for (unsigned int i = 0; i < vertices.size(); ++i) {
-                                    Vector3 v = rv[i];
-
-                                    if (_bake_occlusion) {
-                                        // General purpose occlusion colouring.
-                                        // TODO Optimize for cubes
-                                        // TODO Fix occlusion inconsistency caused by triangles orientation
-                                        float shade = 0;
-                                        for (unsigned int j = 0; j < 4; ++j) {
-                                            unsigned int corner = g_side_corners[side][j];
-                                            if (shaded_corner[corner]) {
-                                                float s = baked_occlusion_darkness * static_cast<float>(shaded_corner[corner]);
-                                                float k = 1.0 - g_corner_position[corner].distance_to(v);
-                                                if (k < 0.0)
-                                                    k = 0.0;
-                                                s *= k;
-                                                if (s > shade)
-                                                    shade = s;
-                                            }
-                                        }
-                                        float gs = 1.0 - shade;
-                                        st.add_color(Color(gs, gs, gs));
-                                    }
-
-                                    st.add_normal(Vector3(normal.x, normal.y, normal.z));
-                                    st.add_uv(rt[i]);
-                                    st.add_vertex(v + pos);
-                                }
-                            }
-                        }
-                    }
+template <typename Voxels_T>
+void VoxelMesher::build_faces_bitmask(const Voxels_T & buffer, unsigned int channel_number, Surface * surfaces, Scratch & scratch, int min_y, int max_y) const {
+
+    const VoxelLibrary & library = **_library;
+    const Vector3i buffer_size = buffer.get_size();
+
+    // Each column of voxels along Y becomes a few 64-bit masks with one bit per voxel, so the faces
+    // of plain cubes are culled for the whole column with a few bitwise operations.
+    // Rows are in [z][x] order.
+    const int row_count = buffer_size.x * buffer_size.z;
+    // Opaque cubes, without hidden faces. Their faces are found with the masks.
+    const int CUBES = Voxel::SIDE_COUNT;
+    // Voxels with other geometry, which go through the per-voxel path
+    const int OTHERS = Voxel::SIDE_COUNT + 1;
+    // The first masks, one per side, tell which voxels hide the face of their neighbor on that side
+    Vector<uint64_t> & masks = scratch.column_masks;
+    masks.resize((Voxel::SIDE_COUNT + 2) * row_count);
+    Vector<uint32_t> * side_masks = scratch.side_masks;
+
+    // Only the meshed range and the voxels around it are read, in padded coordinates
+    const int read_min_y = min_y;
+    const int read_max_y = MIN(max_y + 2, buffer_size.y);
+
+    int row = 0;
+    for (int z = 0; z < buffer_size.z; ++z) {
+        for (int x = 0; x < buffer_size.x; ++x, ++row) {
 
-                    // Inside
-                    if (voxel.get_model_vertices().size() != 0) {
+            uint64_t row_masks[Voxel::SIDE_COUNT + 2] = { 0 };
 
-                        const DVector<Vector3> & vertices = voxel.get_model_vertices();
-                        DVector<Vector3>::Read rv = voxel.get_model_vertices().read();
-                        DVector<Vector3>::Read rn = voxel.get_model_normals().read();
-                        DVector<Vector2>::Read rt = voxel.get_model_uv().read();
-                        Vector3 pos(x - 1, y - 1, z - 1);
+            for (int y = read_min_y; y < read_max_y; ++y) {
 
-                        for (unsigned int i = 0; i < vertices.size(); ++i) {
-                            st.add_normal(rn[i]);
-                            st.add_uv(rt[i]);
-                            st.add_vertex(rv[i] + pos);
+                const int voxel_id = buffer.get_voxel(x, y, z, channel_number);
+                const uint64_t bit = uint64_t(1) << y;
+
+                const bool transparent = library.get_baked_transparent(voxel_id);
+                const uint8_t hidden_faces = library.get_baked_hidden_faces(voxel_id);
+
+                if (!transparent) {
+                    for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+                        if ((hidden_faces & (1 << side)) == 0) {
+                            row_masks[side] |= bit;
                         }
                     }
+                }
 
+                const VoxelLibrary::Geometry geometry = library.get_baked_geometry(voxel_id);
+                if (geometry == VoxelLibrary::GEOMETRY_CUBE && !transparent && hidden_faces == 0) {
+                    row_masks[CUBES] |= bit;
+                }
+                else if (geometry != VoxelLibrary::GEOMETRY_NONE) {
+                    row_masks[OTHERS] |= bit;
                 }
+            }
 
+            for (int i = 0; i < Voxel::SIDE_COUNT + 2; ++i) {
+                masks[i * row_count + row] = row_masks[i];
             }
         }
     }
 
-    // Commit mesh
-    int count_valid_materials = 0;
-    Ref<Mesh> mesh_ref;
-    for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
-        if (_materials[i].is_valid()) {
-        	count_valid_materials++;
-            SurfaceTool & st = _surface_tool[i];
-            
-            // Index mesh to reduce memory usage and make upload to VRAM faster
-            // TODO actually, we could make it indexed from the ground up without using SurfaceTool, so we also save time!
-            st.index();
-
-            mesh_ref = st.commit(mesh_ref);
-            st.clear();
+    // Borders of the padded buffer, and voxels out of the range, are only there to tell if inner faces are visible
+    const uint64_t inner_bits = ((uint64_t(1) << (max_y + 1)) - 1) & ~((uint64_t(1) << (min_y + 1)) - 1);
+
+    for (int z = 1; z < buffer_size.z - 1; ++z) {
+        for (int x = 1; x < buffer_size.x - 1; ++x) {
+
+            row = z * buffer_size.x + x;
+
+            uint64_t others = masks[OTHERS * row_count + row] & inner_bits;
+            while (others != 0) {
+                const unsigned int y = get_lowest_bit_index(others);
+                others &= others - 1;
+                add_voxel(buffer, channel_number, x, y, z, buffer.get_voxel(x, y, z, channel_number), surfaces, side_masks);
+            }
+
+            const uint64_t cubes = masks[CUBES * row_count + row] & inner_bits;
+            if (cubes == 0) {
+                continue;
+            }
+
+            for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+
+                // Neighbors hiding a face on this side are those hiding their opposite face
+                const Vector3i normal = g_side_normals[side];
+                const int neighbor_row = row + normal.z * buffer_size.x + normal.x;
+                uint64_t hiders = masks[Voxel::opposite(side) * row_count + neighbor_row];
+                if (normal.y > 0) {
+                    hiders >>= 1;
+                }
+                else if (normal.y < 0) {
+                    hiders <<= 1;
+                }
+
+                uint64_t visible = cubes & ~hiders;
+                while (visible != 0) {
+                    const unsigned int y = get_lowest_bit_index(visible);
+                    visible &= visible - 1;
+                    const int voxel_id = buffer.get_voxel(x, y, z, channel_number);
+                    add_side(buffer, x, y, z, voxel_id, side, surfaces[library.get_baked_material_id(voxel_id)], side_masks);
+                }
+            }
         }
     }
+}
 
-    ERR_FAIL_COND_V(count_valid_materials == 0, Ref<Mesh>());
+template <typename Voxels_T>
+void VoxelMesher::add_voxel(const Voxels_T & buffer, unsigned int channel_number, unsigned int x, unsigned int y, unsigned int z, int voxel_id, Surface * surfaces, Vector<uint32_t> * side_masks) const {
 
-    return mesh_ref;
+    const VoxelLibrary & library = **_library;
+    const Voxel & voxel = library.get_voxel_const(voxel_id);
+    const uint8_t hidden_faces = library.get_baked_hidden_faces(voxel_id);
+
+    Surface & st = surfaces[library.get_baked_material_id(voxel_id)];
+
+    // Hybrid approach: extract cube faces and decimate those that aren't visible,
+    // and still allow voxels to have geometry that is not a cube
+
+    // Sides
+    for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+
+        if (hidden_faces & (1 << side)) {
+            continue;
+        }
+
+        if (voxel.get_model_side_vertices(side).size() != 0) {
+
+            Vector3i normal = g_side_normals[side];
+            unsigned nx = x + normal.x;
+            unsigned ny = y + normal.y;
+            unsigned nz = z + normal.z;
+
+            int neighbor_voxel_id = buffer.get_voxel(nx, ny, nz, channel_number);
+            // TODO Better face visibility test
+            if (is_face_visible(library, voxel_id, neighbor_voxel_id, Voxel::opposite(side))) {
+                add_side(buffer, x, y, z, voxel_id, side, st, side_masks);
+            }
+        }
+    }
+
+    // Inside
+    if (voxel.get_model_vertices().size() != 0) {
+
+        const DVector<Vector3> & vertices = voxel.get_model_vertices();
+        DVector<Vector3>::Read rv = voxel.get_model_vertices().read();
+        DVector<Vector3>::Read rn = voxel.get_model_normals().read();
+        DVector<Vector2>::Read rt = voxel.get_model_uv().read();
+        Vector3 pos(x - 1, y - 1, z - 1);
+
+        st.reserve(vertices.size(), vertices.size());
+        for (unsigned int i = 0; i < vertices.size(); ++i) {
+            st.add_normal(rn[i]);
+            st.add_uv(rt[i]);
+            if (_greedy_meshing)
+                st.add_uv2(Vector2());
+            st.add_index(st.add_vertex(rv[i] + pos));
+        }
+    }
+}
+
+// Finds which corner of a side each of its 6 vertices is on, in g_side_corners order, and the first vertex
+// on each corner. Returns false if the vertices don't make a quad covering the side.
+static bool find_side_corners(const DVector<Vector3>::Read & rv, int vertex_count, unsigned int side, int vertex_corners[6], int corner_vertices[4]) {
+    if (vertex_count != 6) {
+        return false;
+    }
+    const unsigned int * corners = g_side_corners[side];
+    for (unsigned int j = 0; j < 4; ++j) {
+        corner_vertices[j] = -1;
+    }
+    for (unsigned int i = 0; i < 6; ++i) {
+        int j = 0;
+        while (j < 4 && !(rv[i] == g_corner_position[corners[j]])) {
+            ++j;
+        }
+        if (j == 4) {
+            return false;
+        }
+        vertex_corners[i] = j;
+        if (corner_vertices[j] < 0) {
+            corner_vertices[j] = i;
+        }
+    }
+    for (unsigned int j = 0; j < 4; ++j) {
+        if (corner_vertices[j] < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Voxels_T>
+void VoxelMesher::add_side(const Voxels_T & buffer, unsigned int x, unsigned int y, unsigned int z, int voxel_id, unsigned int side, Surface & st, Vector<uint32_t> * side_masks) const {
+
+    const VoxelLibrary & library = **_library;
+    const Voxel & voxel = library.get_voxel_const(voxel_id);
+    const DVector<Vector3> & vertices = voxel.get_model_side_vertices(side);
+    const Vector3i normal = g_side_normals[side];
+
+    const bool is_cube = library.get_baked_geometry(voxel_id) == VoxelLibrary::GEOMETRY_CUBE;
+
+    int shaded_corner[8] = { 0 };
+    // Packed like g_cube_face_occlusion
+    uint8_t cube_occlusion = 0;
+
+    if (_bake_occlusion && is_cube) {
+
+        uint8_t neighbors = 0;
+        for (unsigned int j = 0; j < 4; ++j) {
+            Vector3i edge_normal = g_edge_inormals[g_side_edges[side][j]];
+            if (!is_transparent(library, buffer.get_voxel(x + edge_normal.x, y + edge_normal.y, z + edge_normal.z))) {
+                neighbors |= 1 << j;
+            }
+            Vector3i corner_normal = g_corner_inormals[g_side_corners[side][j]];
+            if (!is_transparent(library, buffer.get_voxel(x + corner_normal.x, y + corner_normal.y, z + corner_normal.z))) {
+                neighbors |= 1 << (4 + j);
+            }
+        }
+        cube_occlusion = g_cube_face_occlusion[neighbors];
+    }
+    else if (_bake_occlusion) {
+
+        // Combinatory solution for https://0fps.net/2013/07/03/ambient-occlusion-for-minecraft-like-worlds/
+
+        for (unsigned int j = 0; j < 4; ++j) {
+            unsigned int edge = g_side_edges[side][j];
+            Vector3i edge_normal = g_edge_inormals[edge];
+            unsigned ex = x + edge_normal.x;
+            unsigned ey = y + edge_normal.y;
+            unsigned ez = z + edge_normal.z;
+            if (!is_transparent(library, buffer.get_voxel(ex, ey, ez))) {
+                shaded_corner[g_edge_corners[edge][0]] += 1;
+                shaded_corner[g_edge_corners[edge][1]] += 1;
+            }
+        }
+        for (unsigned int j = 0; j < 4; ++j) {
+            unsigned int corner = g_side_corners[side][j];
+            if (shaded_corner[corner] == 2) {
+                shaded_corner[corner] = 3;
+            }
+            else {
+                Vector3i corner_normal = g_corner_inormals[corner];
+                unsigned int cx = x + corner_normal.x;
+                unsigned int cy = y + corner_normal.y;
+                unsigned int cz = z + corner_normal.z;
+                if (!is_transparent(library, buffer.get_voxel(cx, cy, cz))) {
+                    shaded_corner[corner] += 1;
+                }
+            }
+        }
+    }
+
+    if (is_cube) {
+        // The face can be merged if its 4 corners have the same shade
+        const int occlusion = cube_occlusion & 3;
+        if (_greedy_meshing && cube_occlusion == occlusion * 0x55) {
+            const Vector3i buffer_size = buffer.get_size();
+            int i = ((z - 1) * (buffer_size.x - 2) + (x - 1)) * (buffer_size.y - 2) + (y - 1);
+            side_masks[side][i] = ((voxel_id + 1) << 2) | occlusion;
+        }
+        else {
+            add_cube_side(voxel, x, y, z, side, cube_occlusion, st);
+        }
+        return;
+    }
+
+    const float baked_occlusion_darkness = _baked_occlusion_darkness / 3.0;
+
+    DVector<Vector3>::Read rv = vertices.read();
+    DVector<Vector2>::Read rt = voxel.get_model_side_uv(side).read();
+    Vector3 pos(x - 1, y - 1, z - 1);
+
+    // Vertices of a quad on the corners of the side are written once per corner
+    int vertex_corners[6];
+    int corner_vertices[4];
+    int corner_indices[4];
+    const bool quad = find_side_corners(rv, vertices.size(), side, vertex_corners, corner_vertices);
+
+    st.reserve(vertices.size(), vertices.size());
+    for (unsigned int i = 0; i < vertices.size(); ++i) {
+        if (quad && corner_vertices[vertex_corners[i]] != int(i)) {
+            st.add_index(corner_indices[vertex_corners[i]]);
+            continue;
+        }
+
+        Vector3 v = rv[i];
+
+        if (_bake_occlusion) {
+            // General purpose occlusion colouring, cubes go through add_cube_side()
+            float shade = 0;
+            for (unsigned int j = 0; j < 4; ++j) {
+                unsigned int corner = g_side_corners[side][j];
+                if (shaded_corner[corner]) {
+                    float s = baked_occlusion_darkness * static_cast<float>(shaded_corner[corner]);
+                    float k = 1.0 - g_corner_position[corner].distance_to(v);
+                    if (k < 0.0)
+                        k = 0.0;
+                    s *= k;
+                    if (s > shade)
+                        shade = s;
+                }
+            }
+            float gs = 1.0 - shade;
+            st.add_color(Color(gs, gs, gs));
+        }
+
+        st.add_normal(Vector3(normal.x, normal.y, normal.z));
+        st.add_uv(rt[i]);
+        if (_greedy_meshing)
+            st.add_uv2(Vector2());
+        const int index = st.add_vertex(v + pos);
+        if (quad)
+            corner_indices[vertex_corners[i]] = index;
+        st.add_index(index);
+    }
+}
+
+void VoxelMesher::add_cube_side(const Voxel & voxel, unsigned int x, unsigned int y, unsigned int z, unsigned int side, uint8_t cube_occlusion, Surface & st) const {
+
+    const DVector<Vector3> & vertices = voxel.get_model_side_vertices(side);
+    ERR_FAIL_COND(vertices.size() != 6);
+
+    DVector<Vector3>::Read rv = vertices.read();
+    DVector<Vector2>::Read rt = voxel.get_model_side_uv(side).read();
+
+    // Find which corner of the face each vertex is on
+    const unsigned int * corners = g_side_corners[side];
+    int vertex_corners[6];
+    int corner_vertices[4];
+    ERR_FAIL_COND(!find_side_corners(rv, vertices.size(), side, vertex_corners, corner_vertices));
+
+    // Corners are in order around the face, the first triangle tells in which direction it's wound
+    const bool forward = (vertex_corners[1] - vertex_corners[0] + 4) % 4 == 1
+            || (vertex_corners[2] - vertex_corners[1] + 4) % 4 == 1;
+
+    int occlusion[4];
+    for (unsigned int j = 0; j < 4; ++j) {
+        occlusion[j] = (cube_occlusion >> (2 * j)) & 3;
+    }
+
+    // Vertex colors are interpolated across triangles, so the quad is split along its most occluded diagonal
+    // to keep the gradient of a single darker corner symmetric, whatever the orientation of the face
+    const int d = occlusion[0] + occlusion[2] >= occlusion[1] + occlusion[3] ? 0 : 1;
+    int triangles[6] = { d, d + 1, d + 2, d, d + 2, d + 3 };
+    if (!forward) {
+        SWAP(triangles[1], triangles[2]);
+        SWAP(triangles[4], triangles[5]);
+    }
+
+    const float baked_occlusion_darkness = _baked_occlusion_darkness / 3.0;
+    const Vector3i normal = g_side_normals[side];
+    const Vector3 pos(x - 1, y - 1, z - 1);
+
+    // 4 vertices and 6 indices
+    st.reserve(4, 6);
+    int base = 0;
+    for (unsigned int j = 0; j < 4; ++j) {
+
+        if (_bake_occlusion) {
+            float gs = 1.0 - baked_occlusion_darkness * static_cast<float>(occlusion[j]);
+            st.add_color(Color(gs, gs, gs));
+        }
+
+        st.add_normal(Vector3(normal.x, normal.y, normal.z));
+        st.add_uv(rt[corner_vertices[j]]);
+        if (_greedy_meshing)
+            st.add_uv2(Vector2());
+        const int index = st.add_vertex(g_corner_position[corners[j]] + pos);
+        if (j == 0)
+            base = index;
+    }
+    for (unsigned int i = 0; i < 6; ++i) {
+        st.add_index(base + triangles[i] % 4);
+    }
+}
+
+void VoxelMesher::build_greedy_quads(Vector<uint32_t> * side_masks, const Vector3i & size, Surface * surfaces) const {
+
+    const VoxelLibrary & library = **_library;
+    const float tile_size = 1.f / static_cast<float>(library.get_atlas_size());
+    const float baked_occlusion_darkness = _baked_occlusion_darkness / 3.0;
+
+    // Strides of the [z][x][y] masks
+    const int strides[3] = { size.y, 1, size.y * size.x };
+
+    for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+
+        Vector<uint32_t> & mask = side_masks[side];
+
+        // Faces are merged in slices along the normal, over the two other axes
+        const unsigned int a = g_side_coord[side];
+        const unsigned int u = (a + 1) % 3;
+        const unsigned int v = (a + 2) % 3;
+        const int size_u = size[u];
+        const int size_v = size[v];
+
+        for (int s = 0; s < size[a]; ++s) {
+            for (int iv = 0; iv < size_v; ++iv) {
+                for (int iu = 0; iu < size_u; ) {
+
+                    const int i0 = s * strides[a] + iu * strides[u] + iv * strides[v];
+                    const uint32_t key = mask[i0];
+                    if (key == 0) {
+                        ++iu;
+                        continue;
+                    }
+
+                    // Grow along u, then along v as long as whole rows match
+                    int w = 1;
+                    while (iu + w < size_u && mask[i0 + w * strides[u]] == key) {
+                        ++w;
+                    }
+                    int h = 1;
+                    for (; iv + h < size_v; ++h) {
+                        const int row = i0 + h * strides[v];
+                        int k = 0;
+                        while (k < w && mask[row + k * strides[u]] == key) {
+                            ++k;
+                        }
+                        if (k != w) {
+                            break;
+                        }
+                    }
+
+                    // Consume merged faces
+                    for (int j = 0; j < h; ++j) {
+                        const int row = i0 + j * strides[v];
+                        for (int k = 0; k < w; ++k) {
+                            mask[row + k * strides[u]] = 0;
+                        }
+                    }
+
+                    const int voxel_id = (key >> 2) - 1;
+                    const Voxel & voxel = library.get_voxel_const(voxel_id);
+                    const int occlusion = key & 3;
+                    Surface & st = surfaces[library.get_baked_material_id(voxel_id)];
+
+                    const DVector<Vector3> & vertices = voxel.get_model_side_vertices(side);
+                    const DVector<Vector2> & uvs = voxel.get_model_side_uv(side);
+                    DVector<Vector3>::Read rv = vertices.read();
+                    DVector<Vector2>::Read rt = uvs.read();
+
+                    // The tile is where the single face would be textured.
+                    // Its texture coordinates are repeated over the quad, following the axis each of them goes along.
+                    Vector2 tile = rt[0];
+                    for (int j = 1; j < uvs.size(); ++j) {
+                        tile.x = MIN(tile.x, rt[j].x);
+                        tile.y = MIN(tile.y, rt[j].y);
+                    }
+                    bool uv_x_along_u = true;
+                    for (int j = 0; j < vertices.size(); ++j) {
+                        float fu = rv[j][u];
+                        float fx = Math::floor((rt[j].x - tile.x) / tile_size + 0.5);
+                        if (fx != fu && fx != 1.f - fu)
+                            uv_x_along_u = false;
+                    }
+                    const float repeat_x = uv_x_along_u ? w : h;
+                    const float repeat_y = uv_x_along_u ? h : w;
+
+                    const Vector3i normal = g_side_normals[side];
+                    const float gs = 1.0 - baked_occlusion_darkness * static_cast<float>(occlusion);
+
+                    // Only cube sides are merged, their 6 vertices are on the 4 corners
+                    int vertex_corners[6];
+                    int corner_vertices[4];
+                    int corner_indices[4];
+                    if (!find_side_corners(rv, vertices.size(), side, vertex_corners, corner_vertices)) {
+                        ERR_PRINT("Merged side is not a quad");
+                        iu += w;
+                        continue;
+                    }
+
+                    st.reserve(4, 6);
+                    for (int j = 0; j < 6; ++j) {
+                        if (corner_vertices[vertex_corners[j]] != j) {
+                            st.add_index(corner_indices[vertex_corners[j]]);
+                            continue;
+                        }
+
+                        Vector3 sv = rv[j];
+                        Vector3 p;
+                        p[a] = sv[a] + s;
+                        p[u] = sv[u] * w + iu;
+                        p[v] = sv[v] * h + iv;
+
+                        float fx = Math::floor((rt[j].x - tile.x) / tile_size + 0.5);
+                        float fy = Math::floor((rt[j].y - tile.y) / tile_size + 0.5);
+
+                        if (_bake_occlusion)
+                            st.add_color(Color(gs, gs, gs));
+                        st.add_normal(Vector3(normal.x, normal.y, normal.z));
+                        st.add_uv(tile);
+                        st.add_uv2(Vector2(fx * repeat_x, fy * repeat_y));
+                        corner_indices[vertex_corners[j]] = st.add_vertex(p);
+                        st.add_index(corner_indices[vertex_corners[j]]);
+                    }
+
+                    iu += w;
+                }
+            }
+        }
+    }
 }
 
 Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel, int light_channel, Vector3i block_pos_in_world) {
@@ -366,11 +1128,7 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 
 	const VoxelLibrary & library = **_library;
 
-	for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
-		_surface_tool[i].begin(Mesh::PRIMITIVE_TRIANGLES);
-	}
-
-	float baked_occlusion_darkness = _baked_occlusion_darkness / 3.0;
+	Output output;
 
 	const Vector3i buffer_size = buffer->get_size();
 	for (unsigned int z = 1; z < buffer_size.z - 1; ++z) {
@@ -379,15 +1137,16 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 
 				int voxel_id = buffer->get_voxel(x, y, z, solid_channel);
 
-				if (library.has_voxel(voxel_id)) {
+				if (library.get_baked_geometry(voxel_id) != VoxelLibrary::GEOMETRY_NONE) {
 
 					const Voxel & voxel = library.get_voxel_const(voxel_id);
+					const uint8_t hidden_faces = library.get_baked_hidden_faces(voxel_id);
 
-					SurfaceTool & st = _surface_tool[voxel.get_material_id()];
+					Surface & st = output.surfaces[library.get_baked_material_id(voxel_id)];
 
 					for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
 
-						if (!voxel.is_face_visible(side)) {
+						if (hidden_faces & (1 << side)) {
 							continue;
 						}
 
@@ -401,7 +1160,7 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 
 							bool maskLight = buffer->get_voxel(x, y, z, light_channel) == 15;
 							int neighbor_voxel_id = buffer->get_voxel(nx, ny, nz, solid_channel);
-							if (is_face_visible(library, voxel, neighbor_voxel_id, Voxel::opposite(side))) {
+							if (is_face_visible(library, voxel_id, neighbor_voxel_id, Voxel::opposite(side))) {
 								// The face is visible
 
 								float light_corner[8] = { 0 };
@@ -455,7 +1214,18 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 								DVector<Vector2>::Read rt = voxel.get_model_side_uv(side).read();
 								Vector3 pos(x - 1, y - 1, z - 1);
 
+								int vertex_corners[6];
+								int corner_vertices[4];
+								int corner_indices[4];
+								const bool quad = find_side_corners(rv, vertices.size(), side, vertex_corners, corner_vertices);
+
+								st.reserve(vertices.size(), vertices.size());
 								for (unsigned int i = 0; i < vertices.size(); ++i) {
+									if (quad && corner_vertices[vertex_corners[i]] != int(i)) {
+										st.add_index(corner_indices[vertex_corners[i]]);
+										continue;
+									}
+
 									Vector3 v = rv[i] + pos;
 
 									Vector3 random = Vector3(0, 0, 0);
@@ -476,7 +1246,10 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 
 									st.add_normal(normal.to_vec3());
 									st.add_uv(rt[i]);
-									st.add_vertex(v);
+									const int index = st.add_vertex(v);
+									if (quad)
+										corner_indices[vertex_corners[i]] = index;
+									st.add_index(index);
 								}
 							}
 						}
@@ -491,10 +1264,11 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 						DVector<Vector2>::Read rt = voxel.get_model_uv().read();
 						Vector3 pos(x - 1, y - 1, z - 1);
 
+						st.reserve(vertices.size(), vertices.size());
 						for (unsigned int i = 0; i < vertices.size(); ++i) {
 							st.add_normal(rn[i]);
 							st.add_uv(rt[i]);
-							st.add_vertex(rv[i] + pos);
+							st.add_index(st.add_vertex(rv[i] + pos));
 						}
 					}
 
@@ -504,24 +1278,17 @@ Ref<Mesh> VoxelMesher::build_lighted(Ref<VoxelBuffer> buffer, int solid_channel,
 		}
 	}
 
-	// Commit mesh
-	int count_valid_materials = 0;
-	Ref<Mesh> mesh_ref;
 	for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
-		if (_materials[i].is_valid()) {
-			count_valid_materials++;
-			SurfaceTool & st = _surface_tool[i];
-
-			st.index();
+		output.surfaces[i].finish();
+	}
 
-			mesh_ref = st.commit(mesh_ref);
-			st.clear();
+	if (_compact_vertices) {
+		for (unsigned int i = 0; i < MAX_MATERIALS; ++i) {
+			output.surfaces[i].pack_normals();
 		}
 	}
 
-	ERR_FAIL_COND_V(count_valid_materials == 0, Ref<Mesh>());
-
-	return mesh_ref;
+	return commit(output);
 }
 
 void VoxelMesher::_bind_methods() {
@@ -538,6 +1305,15 @@ void VoxelMesher::_bind_methods() {
     ObjectTypeDB::bind_method(_MD("set_occlusion_darkness", "value"), &VoxelMesher::set_occlusion_darkness);
 	ObjectTypeDB::bind_method(_MD("get_occlusion_darkness"), &VoxelMesher::get_occlusion_darkness);
 
+    ObjectTypeDB::bind_method(_MD("set_greedy_meshing", "enable"), &VoxelMesher::set_greedy_meshing);
+	ObjectTypeDB::bind_method(_MD("get_greedy_meshing"), &VoxelMesher::get_greedy_meshing);
+
+    ObjectTypeDB::bind_method(_MD("set_bitmask_culling", "enable"), &VoxelMesher::set_bitmask_culling);
+	ObjectTypeDB::bind_method(_MD("get_bitmask_culling"), &VoxelMesher::get_bitmask_culling);
+
+    ObjectTypeDB::bind_method(_MD("set_compact_vertices", "enable"), &VoxelMesher::set_compact_vertices);
+	ObjectTypeDB::bind_method(_MD("get_compact_vertices"), &VoxelMesher::get_compact_vertices);
+
 	ObjectTypeDB::bind_method(_MD("set_randomize_factor", "factor:Vector3", "blockpos:Vector3"), &VoxelMesher::set_randomize_factor);
 
 	ObjectTypeDB::bind_method(_MD("build", "voxel_buffer:VoxelBuffer", "channel_number:int"), &VoxelMesher::build_ref);
@@ -3,10 +3,10 @@
 
 #include <reference.h>
 #include <scene/resources/mesh.h>
-#include <scene/resources/surface_tool.h>
 #include "voxel.h"
 #include "voxel_buffer.h"
 #include "voxel_library.h"
+#include "voxel_neighborhood.h"
 
 class VoxelMesher : public Reference {
 	OBJ_TYPE(VoxelMesher, Reference)
@@ -28,9 +28,164 @@ public:
 	void set_occlusion_enabled(bool enable);
 	bool get_occlusion_enabled() const { return _bake_occlusion; }
 
+	// Merges coplanar faces of cube voxels having the same type and occlusion into bigger quads.
+	// Merged quads have the atlas position of the tile in UV, and the position of the fragment in tiles in UV2,
+	// so the material must sample `UV + fract(UV2) / atlas_size`. Other faces have UV2 = (0, 0).
+	void set_greedy_meshing(bool enable) { _greedy_meshing = enable; }
+	bool get_greedy_meshing() const { return _greedy_meshing; }
+
+	// Finds visible faces of opaque cubes 64 voxels at a time, using bitmasks of voxel columns.
+	// Used when buffers are at most 64 voxels high. Can be turned off to compare with the per-voxel path.
+	void set_bitmask_culling(bool enable) { _bitmask_culling = enable; }
+	bool get_bitmask_culling() const { return _bitmask_culling; }
+
+	// Leaves normals out of meshes, and packs them in colors instead: COLOR.r is the shade (occlusion or light),
+	// and COLOR.g the index of the normal in Voxel::Side order divided by 5. The material needs a shader rebuilding
+	// NORMAL from COLOR.g. Normals of voxel models are snapped to the closest axis.
+	// Only meshes with colors are packed, so it has no effect when occlusion is off: a vertex takes 48 bytes with
+	// occlusion (position, normal, UV, color) and 36 packed, but 32 without, which a color would grow to 36.
+	// Greedy meshing adds 8 bytes of UV2, and indices about 6 more per vertex.
+	void set_compact_vertices(bool enable) { _compact_vertices = enable; }
+	bool get_compact_vertices() const { return _compact_vertices; }
+
+	// Changes when settings affecting the meshes built from the same voxels change.
+	// Edits made to voxel types of the library are not taken into account.
+	uint64_t get_settings_hash() const;
+
     Ref<Mesh> build(const VoxelBuffer & buffer_ref, unsigned int channel_number);
     Ref<Mesh> build_ref(Ref<VoxelBuffer> buffer_ref, unsigned int channel_number);
 
+	// Indexed geometry of one material. It is filled like a SurfaceTool, but doesn't involve any server,
+	// so it can be used from worker threads.
+	// Arrays are written in place: reserve() makes room ahead, doubling their size when they are full,
+	// and finish() trims them to what was written.
+	class Surface {
+	public:
+		Surface() : _color(1, 1, 1), _has_color(false), _has_uv2(false), _vertex_count(0), _index_count(0) {}
+
+		// Makes room for that many more vertices and indices
+		_FORCE_INLINE_ void reserve(int vertex_count, int index_count) {
+			if (_vertex_count + vertex_count > positions.size() || _index_count + index_count > indices.size()) {
+				grow(vertex_count, index_count);
+			}
+		}
+
+		_FORCE_INLINE_ void add_color(Color color) {
+			if (!_has_color) {
+				// Vertices added before had no color
+				colors.resize(positions.size());
+				for (int i = 0; i < _vertex_count; ++i) {
+					colors[i] = Color(1, 1, 1);
+				}
+				_has_color = true;
+			}
+			_color = color;
+		}
+		_FORCE_INLINE_ void add_normal(Vector3 normal) { _normal = normal; }
+		_FORCE_INLINE_ void add_uv(Vector2 uv) { _uv = uv; }
+		_FORCE_INLINE_ void add_uv2(Vector2 uv) {
+			if (!_has_uv2) {
+				uv2s.resize(positions.size());
+				for (int i = 0; i < _vertex_count; ++i) {
+					uv2s[i] = Vector2();
+				}
+				_has_uv2 = true;
+			}
+			_uv2 = uv;
+		}
+
+		// Writes a vertex with the attributes given before it, and returns its index.
+		// Vertices are never shared by comparing them: quads write their 4 corners and index them 6 times.
+		_FORCE_INLINE_ int add_vertex(Vector3 vertex) {
+			const int i = _vertex_count++;
+			positions[i] = vertex;
+			normals[i] = _normal;
+			uvs[i] = _uv;
+			if (_has_color)
+				colors[i] = _color;
+			if (_has_uv2)
+				uv2s[i] = _uv2;
+			return i;
+		}
+		_FORCE_INLINE_ void add_index(int index) { indices[_index_count++] = index; }
+
+		void finish();
+		void clear();
+		// Starts over, but keeps the arrays so they don't have to grow again
+		void reset();
+		// Copies what was written, leaving other finished
+		void copy_to(Surface & other) const;
+
+		// See set_compact_vertices()
+		void pack_normals();
+		// Adds the faces of another surface after those of this one
+		void append(const Surface & other);
+
+		Vector<Vector3> positions;
+		Vector<Vector3> normals;
+		Vector<Vector2> uvs;
+		Vector<Color> colors; // Empty if the surface has no colors
+		Vector<Vector2> uv2s; // Empty if the surface has no UV2
+		Vector<int> indices;
+
+	private:
+		void grow(int vertex_count, int index_count);
+
+		Vector3 _normal;
+		Vector2 _uv;
+		Vector2 _uv2;
+		Color _color;
+		bool _has_color;
+		bool _has_uv2;
+		// Written so far, arrays can be larger until finish()
+		int _vertex_count;
+		int _index_count;
+	};
+
+	struct Output {
+		Surface surfaces[MAX_MATERIALS];
+
+		int get_vertex_count() const;
+		// Bytes taken by the arrays, close to what the mesh will use once committed
+		int get_memory_usage() const;
+	};
+
+	// Memory used while building a mesh. Everything else build_arrays() uses is read-only configuration,
+	// so several threads can build with the same mesher as long as each has its own scratch.
+	// Keeping one per thread avoids allocating it again for every block of the same size.
+	class Scratch {
+	public:
+		Vector<uint64_t> column_masks;
+		Vector<uint32_t> side_masks[Voxel::SIDE_COUNT];
+		// Filled first, then copied to the output with their exact size
+		Surface surfaces[MAX_MATERIALS];
+	};
+
+	// Same as build(), but outputs raw arrays. Safe to call from a worker thread.
+	void build_arrays(const VoxelBuffer & buffer, unsigned int channel_number, Output & output, Scratch & scratch) const;
+	void build_arrays(const VoxelBuffer & buffer, unsigned int channel_number, Output & output) const;
+	// Same, reading voxels where they are in the block and its neighbors instead of a padded copy
+	void build_arrays(const VoxelNeighborhood & neighborhood, unsigned int channel_number, Output & output, Scratch & scratch) const;
+
+	// Height in voxels of the horizontal slabs a block can be meshed in, see build_slabs()
+	static const int SLAB_HEIGHT = 4;
+	static const uint32_t ALL_SLABS = 0xffffffff;
+
+	// Same as build_arrays(), but meshes the block in one output per slab, so that after an edit only the slabs
+	// it touches need to be built again. Slabs whose bit is not set in dirty_slabs are kept as they are.
+	// If the number of slabs doesn't match the block, they are all built.
+	void build_slabs(const VoxelBuffer & buffer, unsigned int channel_number, Vector<Output> & slabs, uint32_t dirty_slabs, Scratch & scratch) const;
+	void build_slabs(const VoxelNeighborhood & neighborhood, unsigned int channel_number, Vector<Output> & slabs, uint32_t dirty_slabs, Scratch & scratch) const;
+	// Joins slabs into one output that can be committed
+	static void merge_slabs(const Vector<Output> & slabs, Output & output);
+	// Bits of the slabs containing voxels from min_y to max_y included, in block coordinates
+	static uint32_t get_slabs_in_range(int min_y, int max_y);
+
+	// Creates a mesh from the result of build_arrays(). Must be called from the main thread.
+	Ref<Mesh> commit(const Output & output) const;
+	// Same, but replaces the surfaces of a mesh created directly in the VisualServer
+	void commit(const Output & output, RID mesh) const;
+
 private:
     Ref<Mesh> _build_lighted_binding(Ref<VoxelBuffer> buffer, int solid_channel, int light_channel, Vector3 block_pos_in_world) {
     	return build_lighted(buffer, solid_channel, light_channel, Vector3i(block_pos_in_world));
@@ -52,7 +207,26 @@ protected:
 	static void _bind_methods();
 
 private:
-	Vector3 _fixed_randomize (Vector3 input) {
+	// Voxels_T is a VoxelBuffer or a VoxelNeighborhood, anything with get_size() and get_voxel(x, y, z, channel)
+	template <typename Voxels_T>
+	void build_output(const Voxels_T & buffer, unsigned int channel_number, Output & output, Scratch & scratch) const;
+	template <typename Voxels_T>
+	void build_slabs_output(const Voxels_T & buffer, unsigned int channel_number, Vector<Output> & slabs, uint32_t dirty_slabs, Scratch & scratch) const;
+	// Only voxels with min_y <= y < max_y are meshed, in inner coordinates of the padded buffer
+	template <typename Voxels_T>
+	void build_surfaces(const Voxels_T & buffer, unsigned int channel_number, Surface * surfaces, Scratch & scratch, int min_y, int max_y) const;
+	template <typename Voxels_T>
+	void build_faces_bitmask(const Voxels_T & buffer, unsigned int channel_number, Surface * surfaces, Scratch & scratch, int min_y, int max_y) const;
+	template <typename Voxels_T>
+	void add_voxel(const Voxels_T & buffer, unsigned int channel_number, unsigned int x, unsigned int y, unsigned int z, int voxel_id, Surface * surfaces, Vector<uint32_t> * side_masks) const;
+	// Adds a side known to be visible, or records it for greedy meshing
+	template <typename Voxels_T>
+	void add_side(const Voxels_T & buffer, unsigned int x, unsigned int y, unsigned int z, int voxel_id, unsigned int side, Surface & st, Vector<uint32_t> * side_masks) const;
+	// Same for a unit cube, with occlusion of its corners packed in 2 bits each
+	void add_cube_side(const Voxel & voxel, unsigned int x, unsigned int y, unsigned int z, unsigned int side, uint8_t cube_occlusion, Surface & st) const;
+	void build_greedy_quads(Vector<uint32_t> * side_masks, const Vector3i & size, Surface * surfaces) const;
+
+	Vector3 _fixed_randomize (Vector3 input) const {
 		uint32_t hash = Math::floor(input.x * 10 + 0.5);
 		hash = 100 * Math::floor(input.y * 10 + 0.5) + hash;
 		hash = 100 * Math::floor(input.z * 10 + 0.5) + hash;
@@ -77,9 +251,11 @@ private:
 
 	Ref<VoxelLibrary> _library;
 	Ref<Material> _materials[MAX_MATERIALS];
-	SurfaceTool _surface_tool[MAX_MATERIALS];
 	float _baked_occlusion_darkness;
 	bool _bake_occlusion;
+	bool _greedy_meshing;
+	bool _bitmask_culling;
+	bool _compact_vertices;
 
 
 };
@@ -0,0 +1,50 @@
+#include "voxel_neighborhood.h"
+
+VoxelNeighborhood::VoxelNeighborhood(const Ref<VoxelBuffer> blocks[27], int default_value) :
+	_block_size(0),
+	_default_value(default_value)
+{
+	for (unsigned int i = 0; i < 27; ++i) {
+		_blocks[i] = blocks[i].is_valid() ? *blocks[i] : NULL;
+	}
+	ERR_FAIL_COND(_blocks[13] == NULL);
+	_block_size = _blocks[13]->get_size().x;
+}
+
+int VoxelNeighborhood::get_voxel_in_neighbor(int x, int y, int z, unsigned int channel_index) const {
+
+	const int bs = _block_size;
+
+	// Which block along each axis, from 0 to 2, and the position in it
+	int bx = x < 1 ? 0 : (x > bs ? 2 : 1);
+	int by = y < 1 ? 0 : (y > bs ? 2 : 1);
+	int bz = z < 1 ? 0 : (z > bs ? 2 : 1);
+
+	const VoxelBuffer * block = _blocks[bz * 9 + bx * 3 + by];
+	if (block == NULL) {
+		return _default_value;
+	}
+
+	return block->get_voxel(x - 1 - (bx - 1) * bs, y - 1 - (by - 1) * bs, z - 1 - (bz - 1) * bs, channel_index);
+}
+
+void VoxelNeighborhood::get_hashes(unsigned int channel_index, uint64_t & out_hash, uint64_t & out_check) const {
+
+	// FNV-1a and djb2, each of them is quick but not strong enough alone
+	uint64_t hash = 14695981039346656037ULL;
+	uint64_t check = 5381;
+
+	const Vector3i size = get_size();
+	for (int z = 0; z < size.z; ++z) {
+		for (int x = 0; x < size.x; ++x) {
+			for (int y = 0; y < size.y; ++y) {
+				const uint64_t v = get_voxel(x, y, z, channel_index);
+				hash = (hash ^ v) * 1099511628211ULL;
+				check = ((check << 5) + check) + v;
+			}
+		}
+	}
+
+	out_hash = hash;
+	out_check = check;
+}
@@ -0,0 +1,38 @@
+#ifndef VOXEL_NEIGHBORHOOD_H
+#define VOXEL_NEIGHBORHOOD_H
+
+#include "voxel_buffer.h"
+
+// Read-only view of a block and its 26 neighbors, addressed like the buffer padded by one voxel
+// that VoxelMap::get_neighborhood_copy() fills, but without copying anything.
+// Blocks are in the same order, and the central one must be present.
+// Voxels inside the central block are read directly, only the shell around it goes to neighbors.
+class VoxelNeighborhood {
+public:
+	VoxelNeighborhood(const Ref<VoxelBuffer> blocks[27], int default_value);
+
+	_FORCE_INLINE_ Vector3i get_size() const { return Vector3i(_block_size + 2, _block_size + 2, _block_size + 2); }
+
+	_FORCE_INLINE_ int get_voxel(int x, int y, int z, unsigned int channel_index = 0) const {
+		const unsigned int bs = _block_size;
+		if (unsigned(x - 1) < bs && unsigned(y - 1) < bs && unsigned(z - 1) < bs) {
+			return _blocks[13]->get_voxel(x - 1, y - 1, z - 1, channel_index);
+		}
+		return get_voxel_in_neighbor(x, y, z, channel_index);
+	}
+
+	// Two independent hashes of all voxels of the channel, so that identical neighborhoods can be recognized.
+	// Using both as a key makes collisions unlikely enough to share meshes.
+	void get_hashes(unsigned int channel_index, uint64_t & out_hash, uint64_t & out_check) const;
+
+private:
+	int get_voxel_in_neighbor(int x, int y, int z, unsigned int channel_index) const;
+
+	// NULL where a neighbor is missing
+	const VoxelBuffer * _blocks[27];
+	int _block_size;
+	// Value of voxels in missing neighbors
+	int _default_value;
+};
+
+#endif // VOXEL_NEIGHBORHOOD_H
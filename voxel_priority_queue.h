@@ -0,0 +1,141 @@
+#ifndef VOXEL_PRIORITY_QUEUE_H
+#define VOXEL_PRIORITY_QUEUE_H
+
+#include <vector.h>
+#include <core/hash_map.h>
+
+// Binary min-heap of unique keys.
+// Unlike a sorted list, the priority of a key already in the queue can be changed in O(log n),
+// so it can be kept up to date incrementally instead of being sorted again.
+template <typename K, typename Hasher>
+class VoxelPriorityQueue {
+public:
+	// Inserts the key, or changes its priority if it's already queued
+	void push(const K & key, int priority) {
+		int * index = _indices.getptr(key);
+		if (index) {
+			set_priority_at(*index, priority);
+		}
+		else {
+			Item item;
+			item.key = key;
+			item.priority = priority;
+			_items.push_back(item);
+			_indices.set(key, _items.size() - 1);
+			sift_up(_items.size() - 1);
+		}
+	}
+
+	_FORCE_INLINE_ bool has(const K & key) const { return _indices.has(key); }
+
+	void erase(const K & key) {
+		const int * index = _indices.getptr(key);
+		if (index) {
+			remove_at(*index);
+		}
+	}
+
+	_FORCE_INLINE_ const K & top() const { return _items[0].key; }
+	_FORCE_INLINE_ int top_priority() const { return _items[0].priority; }
+
+	void pop() {
+		ERR_FAIL_COND(_items.empty());
+		remove_at(0);
+	}
+
+	_FORCE_INLINE_ int size() const { return _items.size(); }
+	_FORCE_INLINE_ bool empty() const { return _items.empty(); }
+
+	void clear() {
+		_items.clear();
+		_indices.clear();
+	}
+
+	// Items can be iterated by index, in no particular order.
+	// Changing a priority moves items around, but only by swapping them.
+	_FORCE_INLINE_ const K & get_key(int i) const { return _items[i].key; }
+	_FORCE_INLINE_ int get_priority(int i) const { return _items[i].priority; }
+
+	void set_priority_at(int i, int priority) {
+		ERR_FAIL_INDEX(i, _items.size());
+		int old_priority = _items[i].priority;
+		_items[i].priority = priority;
+		if (priority < old_priority) {
+			sift_up(i);
+		}
+		else if (priority > old_priority) {
+			sift_down(i);
+		}
+	}
+
+private:
+	struct Item {
+		K key;
+		int priority;
+	};
+
+	void remove_at(int i) {
+		_indices.erase(_items[i].key);
+		int last = _items.size() - 1;
+		if (i != last) {
+			int old_priority = _items[i].priority;
+			_items[i] = _items[last];
+			_indices.set(_items[i].key, i);
+			_items.resize(last);
+			if (_items[i].priority < old_priority) {
+				sift_up(i);
+			}
+			else {
+				sift_down(i);
+			}
+		}
+		else {
+			_items.resize(last);
+		}
+	}
+
+	void sift_up(int i) {
+		while (i > 0) {
+			int parent = (i - 1) / 2;
+			if (_items[parent].priority <= _items[i].priority) {
+				break;
+			}
+			swap(i, parent);
+			i = parent;
+		}
+	}
+
+	void sift_down(int i) {
+		const int count = _items.size();
+		while (true) {
+			int smallest = i;
+			int left = 2 * i + 1;
+			int right = left + 1;
+			if (left < count && _items[left].priority < _items[smallest].priority) {
+				smallest = left;
+			}
+			if (right < count && _items[right].priority < _items[smallest].priority) {
+				smallest = right;
+			}
+			if (smallest == i) {
+				break;
+			}
+			swap(i, smallest);
+			i = smallest;
+		}
+	}
+
+	_FORCE_INLINE_ void swap(int a, int b) {
+		Item temp = _items[a];
+		_items[a] = _items[b];
+		_items[b] = temp;
+		_indices.set(_items[a].key, a);
+		_indices.set(_items[b].key, b);
+	}
+
+	Vector<Item> _items;
+	HashMap<K, int, Hasher> _indices;
+
+};
+
+#endif // VOXEL_PRIORITY_QUEUE_H
@@ -28,6 +28,84 @@ void VoxelProvider::immerge_block(Ref<VoxelBuffer> buffer, Vector3i block_pos) {
 	}
 }
 
+void VoxelProvider::emerge_block_lod(Ref<VoxelBuffer> out_buffer, Vector3i block_pos, int lod) {
+	ERR_FAIL_COND(out_buffer.is_null());
+	ERR_FAIL_COND(lod < 0 || lod > VoxelBlock::SIZE_POW2);
+
+	if (lod == 0) {
+		emerge_block(out_buffer, block_pos);
+		return;
+	}
+
+	ScriptInstance * script = get_script_instance();
+	if(script && script->has_method("emerge_block_lod")) {
+		Variant arg1 = out_buffer;
+		Variant arg2 = block_pos.to_vec3();
+		Variant arg3 = lod;
+		const Variant * args[3] = { &arg1, &arg2, &arg3 };
+		script->call_multilevel("emerge_block_lod", args, 3);
+		return;
+	}
+
+	const int stride = 1 << lod;
+	// How many voxels of the output come from each full resolution block
+	const int step = VoxelBlock::SIZE / stride;
+
+	Ref<VoxelBuffer> buffer_ref = Ref<VoxelBuffer>(memnew(VoxelBuffer));
+	VoxelBuffer & buffer = **buffer_ref;
+	VoxelBuffer & out = **out_buffer;
+
+	Vector3i c;
+	for (c.z = 0; c.z < stride; ++c.z) {
+		for (c.x = 0; c.x < stride; ++c.x) {
+			for (c.y = 0; c.y < stride; ++c.y) {
+
+				buffer.create(VoxelBlock::SIZE, VoxelBlock::SIZE, VoxelBlock::SIZE);
+				emerge_block(buffer_ref, block_pos * stride + c);
+
+				const Vector3i dst_min = c * step;
+				for (unsigned int channel = 0; channel < VoxelBuffer::MAX_CHANNELS; ++channel) {
+					// Unused channels are uniform on both sides
+					if (buffer.is_uniform(channel) && out.is_uniform(channel) && buffer.get_voxel(0, 0, 0, channel) == out.get_voxel(0, 0, 0, channel)) {
+						continue;
+					}
+					Vector3i d;
+					for (d.z = 0; d.z < step; ++d.z) {
+						for (d.x = 0; d.x < step; ++d.x) {
+							for (d.y = 0; d.y < step; ++d.y) {
+								int v = buffer.get_voxel(d.x * stride, d.y * stride, d.z * stride, channel);
+								// Don't allocate channels that are not used
+								if (v != out.get_voxel(dst_min + d, channel)) {
+									out.set_voxel(v, dst_min + d, channel);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+bool VoxelProvider::get_surface_bounds(int block_x, int block_z, int lod, SurfaceBounds & out_bounds) {
+	ScriptInstance * script = get_script_instance();
+	if (script == NULL || !script->has_method("get_surface_bounds")) {
+		return false;
+	}
+
+	Variant result = script->call("get_surface_bounds", Vector2(block_x, block_z), lod);
+	if (result.get_type() != Variant::ARRAY) {
+		return false;
+	}
+	Array bounds = result;
+	ERR_FAIL_COND_V(bounds.size() < 3, false);
+
+	out_bounds.min_y = bounds[0];
+	out_bounds.max_y = bounds[1];
+	out_bounds.ground_voxel = bounds[2];
+	return true;
+}
+
 void VoxelProvider::_emerge_block(Ref<VoxelBuffer> out_buffer, Vector3 block_pos) {
 	emerge_block(out_buffer, Vector3i(block_pos));
 }
@@ -36,10 +114,15 @@ void VoxelProvider::_immerge_block(Ref<VoxelBuffer> buffer, Vector3 block_pos) {
 	immerge_block(buffer, Vector3i(block_pos));
 }
 
+void VoxelProvider::_emerge_block_lod(Ref<VoxelBuffer> out_buffer, Vector3 block_pos, int lod) {
+	emerge_block_lod(out_buffer, Vector3i(block_pos), lod);
+}
+
 void VoxelProvider::_bind_methods() {
 
 	ObjectTypeDB::bind_method(_MD("emerge_block", "out_buffer:VoxelBuffer", "block_pos:Vector3"), &VoxelProvider::_emerge_block);
 	ObjectTypeDB::bind_method(_MD("immerge_block", "buffer:VoxelBuffer", "block_pos:Vector3"), &VoxelProvider::_immerge_block);
+	ObjectTypeDB::bind_method(_MD("emerge_block_lod", "out_buffer:VoxelBuffer", "block_pos:Vector3", "lod"), &VoxelProvider::_emerge_block_lod);
 
 }
 
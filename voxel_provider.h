@@ -11,11 +11,33 @@ public:
 	virtual void emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i block_pos);
 	virtual void immerge_block(Ref<VoxelBuffer> buffer, Vector3i block_pos);
 
+	// Fills a block of a lower level of detail, where one voxel stands for 2^lod voxels along each axis,
+	// and block_pos is in blocks of that level. Voxels are sampled at the lowest corner of the area they cover.
+	// By default, all full resolution blocks of the area are emerged to pick voxels from them,
+	// which gets expensive quickly. Providers able to sample at a lower resolution should override it.
+	// VoxelTerrain calls it from a worker thread, like immerge_block.
+	virtual void emerge_block_lod(Ref<VoxelBuffer> out_buffer, Vector3i block_pos, int lod);
+
+	// Heights between which the surface of a column of blocks can be, in full resolution voxels.
+	// Voxels below min_y are all ground_voxel, and voxels from max_y up are all air (0),
+	// so blocks entirely on one side can be created without emerging them.
+	struct SurfaceBounds {
+		int min_y;
+		int max_y;
+		int ground_voxel;
+	};
+
+	// block_x and block_z are in blocks of the given level of detail. Returns false if bounds are unknown, which is the default.
+	// Scripts can implement get_surface_bounds(column, lod) returning [min_y, max_y, ground_voxel], or null.
+	// Providers that save modified blocks should not give bounds for columns containing any.
+	virtual bool get_surface_bounds(int block_x, int block_z, int lod, SurfaceBounds & out_bounds);
+
 protected:
 	static void _bind_methods();
 
 	void _emerge_block(Ref<VoxelBuffer> out_buffer, Vector3 block_pos);
 	void _immerge_block(Ref<VoxelBuffer> buffer, Vector3 block_pos);
+	void _emerge_block_lod(Ref<VoxelBuffer> out_buffer, Vector3 block_pos, int lod);
 };
 
 
@@ -33,26 +33,62 @@ void VoxelProviderTest::set_pattern_offset(Vector3i offset) {
 
 void VoxelProviderTest::emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i block_pos) {
 	ERR_FAIL_COND(out_buffer.is_null());
+	generate_block(**out_buffer, VoxelMap::block_to_voxel(block_pos), 1);
+}
+
+void VoxelProviderTest::emerge_block_lod(Ref<VoxelBuffer> out_buffer, Vector3i block_pos, int lod) {
+	ERR_FAIL_COND(out_buffer.is_null());
+	ERR_FAIL_COND(lod < 0 || lod > VoxelBlock::SIZE_POW2);
+	// The pattern is cheap to evaluate anywhere, so there is no need to generate full resolution blocks
+	int stride = 1 << lod;
+	generate_block(**out_buffer, VoxelMap::block_to_voxel(block_pos) * stride, stride);
+}
+
+// Bounds are the same for every column and level of detail
+bool VoxelProviderTest::get_surface_bounds(int, int, int, SurfaceBounds & out_bounds) {
+
+	out_bounds.ground_voxel = _voxel_type;
+
+	switch(_mode) {
+
+	case MODE_FLAT:
+		out_bounds.min_y = _pattern_offset.y;
+		out_bounds.max_y = _pattern_offset.y;
+		return true;
+
+	case MODE_WAVES: {
+		// The sum of a sine and a cosine stays within [-2, 2], plus a voxel for rounding
+		int extent = 2 * _pattern_size.y + 1;
+		out_bounds.min_y = -extent;
+		out_bounds.max_y = extent;
+		return true;
+	}
+	}
+
+	return false;
+}
+
+void VoxelProviderTest::generate_block(VoxelBuffer & out_buffer, Vector3i origin, int stride) {
 
 	switch(_mode) {
 
 	case MODE_FLAT:
-		generate_block_flat(**out_buffer, block_pos);
+		generate_block_flat(out_buffer, origin, stride);
 		break;
 
 	case MODE_WAVES:
-		generate_block_waves(**out_buffer, block_pos);
+		generate_block_waves(out_buffer, origin, stride);
 		break;
 	}
 }
 
-void VoxelProviderTest::generate_block_flat(VoxelBuffer & out_buffer, Vector3i block_pos) {
+void VoxelProviderTest::generate_block_flat(VoxelBuffer & out_buffer, Vector3i origin, int stride) {
 
-	// TODO Don't expect a block pos, but a voxel pos!
 	Vector3i size = out_buffer.get_size();
-	Vector3i origin = VoxelMap::block_to_voxel(block_pos);
 
+	// Solid below the pattern offset, rounded up to the next sampled voxel
 	int rh = _pattern_offset.y - origin.y;
+	rh = rh > 0 ? (rh + stride - 1) / stride : 0;
 	if(rh > size.y)
 		rh = size.y;
 
@@ -65,10 +101,10 @@ void VoxelProviderTest::generate_block_flat(VoxelBuffer & out_buffer, Vector3i b
 	}
 }
 
-void VoxelProviderTest::generate_block_waves(VoxelBuffer & out_buffer, Vector3i block_pos) {
+void VoxelProviderTest::generate_block_waves(VoxelBuffer & out_buffer, Vector3i origin, int stride) {
 
 	Vector3i size = out_buffer.get_size();
-	Vector3i origin = VoxelMap::block_to_voxel(block_pos) + _pattern_offset;
+	origin += _pattern_offset;
 	float amplitude = static_cast<float>(_pattern_size.y);
 	float period_x = 1.f/static_cast<float>(_pattern_size.x);
 	float period_z = 1.f/static_cast<float>(_pattern_size.z);
@@ -76,11 +112,12 @@ void VoxelProviderTest::generate_block_waves(VoxelBuffer & out_buffer, Vector3i
 	for(int rz = 0; rz < size.z; ++rz) {
 		for(int rx = 0; rx < size.x; ++rx) {
 
-			float x = origin.x + rx;
-			float z = origin.z + rz;
+			float x = origin.x + rx * stride;
+			float z = origin.z + rz * stride;
 
 			int h = _pattern_offset.y + amplitude * (Math::cos(x*period_x) + Math::sin(z*period_z));
 			int rh = h - origin.y;
+			rh = rh > 0 ? (rh + stride - 1) / stride : 0;
 			if(rh > size.y)
 				rh = size.y;
 
@@ -16,6 +16,8 @@ public:
 	VoxelProviderTest();
 
 	virtual void emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i block_pos);
+	virtual void emerge_block_lod(Ref<VoxelBuffer> out_buffer, Vector3i block_pos, int lod);
+	virtual bool get_surface_bounds(int block_x, int block_z, int lod, SurfaceBounds & out_bounds);
 
 	void set_mode(Mode mode);
 	Mode get_mode() const { return _mode; }
@@ -30,8 +32,10 @@ public:
 	void set_pattern_offset(Vector3i offset);
 
 protected:
-	void generate_block_flat(VoxelBuffer & out_buffer, Vector3i block_pos);
-	void generate_block_waves(VoxelBuffer & out_buffer, Vector3i block_pos);
+	// Voxels are generated from origin, one every stride voxels
+	void generate_block(VoxelBuffer & out_buffer, Vector3i origin, int stride);
+	void generate_block_flat(VoxelBuffer & out_buffer, Vector3i origin, int stride);
+	void generate_block_waves(VoxelBuffer & out_buffer, Vector3i origin, int stride);
 
 	static void _bind_methods();
 
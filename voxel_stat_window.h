@@ -0,0 +1,48 @@
+#ifndef VOXEL_STAT_WINDOW_H
+#define VOXEL_STAT_WINDOW_H
+
+#include <typedefs.h>
+
+// Sum of a value over the last frames, so statistics follow recent changes without jumping around every frame.
+// Values are added during the frame, and end_frame() moves the window.
+class VoxelStatWindow {
+public:
+	static const int SIZE = 120;
+
+	VoxelStatWindow() : _index(0), _count(0), _sum(0), _current(0) {
+		for (int i = 0; i < SIZE; ++i) {
+			_values[i] = 0;
+		}
+	}
+
+	_FORCE_INLINE_ void add(int64_t value) { _current += value; }
+
+	void end_frame() {
+		if (_count == SIZE) {
+			_sum -= _values[_index];
+		}
+		else {
+			++_count;
+		}
+		_values[_index] = _current;
+		_sum += _current;
+		_current = 0;
+		_index = (_index + 1) % SIZE;
+	}
+
+	int64_t get_sum() const { return _sum; }
+	int get_frame_count() const { return _count; }
+
+	float get_average_per_frame() const {
+		return _count == 0 ? 0.f : float(_sum) / float(_count);
+	}
+
+private:
+	int64_t _values[SIZE];
+	int _index;
+	int _count;
+	int64_t _sum;
+	int64_t _current;
+};
+
+#endif // VOXEL_STAT_WINDOW_H
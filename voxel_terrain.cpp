@@ -1,188 +1,2444 @@
 #include "voxel_terrain.h"
+#include "voxel_terrain_streamer.h"
+#include "voxel_connectivity.h"
 #include <scene/3d/mesh_instance.h>
+#include <scene/3d/camera.h>
+#include <scene/main/viewport.h>
+#include <servers/visual_server.h>
+#include <servers/physics_server.h>
 #include <os/os.h>
 
-VoxelTerrain::VoxelTerrain(): Node(), _min_y(-4), _max_y(4) {
+VARIANT_ENUM_CAST(VoxelTerrain::RenderMode)
 
-	_map = Ref<VoxelMap>(memnew(VoxelMap));
+// Blocks in the view of a camera are loaded as if they were this many times closer
+static const int FRUSTUM_PRIORITY_FACTOR = 2;
+
+// Blocks only wanted because a viewer is heading towards them are loaded as if they were this many times farther
+static const int PREFETCH_PRIORITY_FACTOR = 2;
+
+// How much of the measured velocity of a viewer is taken each frame, to smooth out jitter
+static const float VELOCITY_SMOOTHING = 0.2f;
+
+// How many queued blocks get their priority updated per frame after viewers moved
+static const int PRIORITY_REFRESH_BATCH_SIZE = 256;
+
+// Blocks are meshed all the time while streaming, so occlusion is searched again for them at most once in that many frames.
+// The camera moving to another block is taken into account right away.
+static const int OCCLUSION_DIRTY_INTERVAL = 10;
+
+// Same order as Voxel::Side
+static const Vector3i g_side_directions[Voxel::SIDE_COUNT] = {
+	Vector3i(-1, 0, 0),
+	Vector3i(1, 0, 0),
+	Vector3i(0, -1, 0),
+	Vector3i(0, 1, 0),
+	Vector3i(0, 0, -1),
+	Vector3i(0, 0, 1)
+};
+
+// Builds the mesh of one block from a snapshot of its neighborhood
+class VoxelMeshTask : public VoxelTask {
+public:
+	Vector3i block_pos;
+	int lod;
+	Ref<VoxelBuffer> blocks[27];
+	int default_voxel;
+	Ref<VoxelMesher> mesher;
+	// One per thread of the pool
+	const Vector<VoxelMesher::Scratch*> * scratches;
+	// Edited blocks are meshed in slabs, starting from those of their previous mesh
+	bool use_slabs;
+	Vector<VoxelMesher::Output> slabs;
+	uint32_t dirty_slabs;
+	// If not NULL, an existing mesh is looked up before building one
+	const VoxelMeshCache * mesh_cache;
+	uint64_t settings_hash;
+	uint64_t cache_hash;
+	uint64_t cache_check;
+	bool cache_hit;
+	VoxelMeshCache::Entry cached;
+	VoxelMesher::Output output;
+	uint16_t connectivity;
+	// Time spent in run(), for statistics
+	int gather_time;
+	int mesh_time;
+
+	VoxelMeshTask() :
+		lod(0),
+		default_voxel(0),
+		scratches(NULL),
+		use_slabs(false),
+		dirty_slabs(VoxelMesher::ALL_SLABS),
+		mesh_cache(NULL),
+		settings_hash(0),
+		cache_hash(0),
+		cache_check(0),
+		cache_hit(false),
+		connectivity(VoxelConnectivity::ALL),
+		gather_time(0),
+		mesh_time(0) {}
+
+	void run() {
+		OS & os = *OS::get_singleton();
+		uint64_t time_before = os.get_ticks_usec();
+
+		// Voxels are read where they are, blocks can't change while the task holds references on them
+		VoxelNeighborhood neighborhood(blocks, default_voxel);
+
+		uint64_t time_gathered = os.get_ticks_usec();
+		gather_time = time_gathered - time_before;
+
+		// On a hit, the main thread shows the mesh of the cache instead of building one
+		if (mesh_cache) {
+			neighborhood.get_hashes(0, cache_hash, cache_check);
+			cache_hash = hash_djb2_one_64(settings_hash, cache_hash);
+			cache_hit = mesh_cache->get(cache_hash, cache_check, cached);
+		}
+
+		if (!cache_hit) {
+			VoxelMesher::Scratch & scratch = *(*scratches)[thread_index];
+			if (use_slabs) {
+				mesher->build_slabs(neighborhood, 0, slabs, dirty_slabs, scratch);
+				VoxelMesher::merge_slabs(slabs, output);
+			}
+			else {
+				mesher->build_arrays(neighborhood, 0, output, scratch);
+			}
+		}
+
+		// Only level 0 takes part in occlusion culling
+		Ref<VoxelLibrary> library = mesher->get_library();
+		if (lod == 0 && library.is_valid()) {
+			connectivity = VoxelConnectivity::compute(**blocks[13], 0, **library);
+		}
+
+		mesh_time = os.get_ticks_usec() - time_gathered;
+	}
+
+	// True if voxels read by the task have been modified, loaded or removed since it was created.
+	// Modified voxels are always replaced because the task holds a reference on them (see VoxelBlock::get_voxels_for_write).
+	bool is_outdated(const Ref<VoxelBuffer> current_blocks[27]) const {
+		for (unsigned int i = 0; i < 27; ++i) {
+			if (current_blocks[i] != blocks[i]) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// Sends a batch of modified blocks to the provider so they can be saved
+class VoxelSaveTask : public VoxelTask {
+public:
+	Ref<VoxelProvider> provider;
+	Vector<Vector3i> positions;
+	Vector<Ref<VoxelBuffer> > buffers;
+
+	void run() {
+		for (int i = 0; i < positions.size(); ++i) {
+			provider->immerge_block(buffers[i], positions[i]);
+		}
+	}
+};
+
+// Emerges a block of a level above 0, which the provider may build from many full resolution blocks
+class VoxelEmergeTask : public VoxelTask {
+public:
+	Ref<VoxelProvider> provider;
+	Vector3i block_pos;
+	int lod;
+	Ref<VoxelBuffer> buffer;
+	// Time spent in run(), for statistics
+	int emerge_time;
+
+	VoxelEmergeTask() : lod(0), emerge_time(0) {}
+
+	void run() {
+		uint64_t time_before = OS::get_singleton()->get_ticks_usec();
+		provider->emerge_block_lod(buffer, block_pos, lod);
+		emerge_time = OS::get_singleton()->get_ticks_usec() - time_before;
+	}
+};
+
+// Decomposes the solid voxels of a block into boxes for collision
+class VoxelCollisionTask : public VoxelTask {
+public:
+	Vector3i block_pos;
+	Ref<VoxelBuffer> voxels;
+	Ref<VoxelLibrary> library;
+	Vector<Rect3i> boxes;
+
+	void run() {
+		const VoxelBuffer & buffer = **voxels;
+		const Vector3i size = buffer.get_size();
+		const int volume = size.x * size.y * size.z;
+
+		// Voxels that are solid and not covered by a box yet, in [z][x][y] order
+		Vector<uint8_t> open;
+		open.resize(volume);
+
+		int i = 0;
+		Vector3i pos;
+		for (pos.z = 0; pos.z < size.z; ++pos.z) {
+			for (pos.x = 0; pos.x < size.x; ++pos.x) {
+				for (pos.y = 0; pos.y < size.y; ++pos.y) {
+					open[i++] = is_solid(buffer.get_voxel(pos, 0)) ? 1 : 0;
+				}
+			}
+		}
+
+		const int stride_x = size.y;
+		const int stride_z = size.y * size.x;
+
+		// Greedy decomposition: grow a box along y, then x, then z as long as all voxels it covers are open
+		i = 0;
+		for (pos.z = 0; pos.z < size.z; ++pos.z) {
+			for (pos.x = 0; pos.x < size.x; ++pos.x) {
+				for (pos.y = 0; pos.y < size.y; ++pos.y, ++i) {
+					if (!open[i]) {
+						continue;
+					}
+
+					Vector3i box_size(1, 1, 1);
+
+					while (pos.y + box_size.y < size.y && open[i + box_size.y]) {
+						++box_size.y;
+					}
+
+					while (pos.x + box_size.x < size.x && is_row_open(open, i + box_size.x * stride_x, box_size.y)) {
+						++box_size.x;
+					}
+
+					while (pos.z + box_size.z < size.z) {
+						int slice = i + box_size.z * stride_z;
+						bool slice_open = true;
+						for (int x = 0; x < box_size.x && slice_open; ++x) {
+							slice_open = is_row_open(open, slice + x * stride_x, box_size.y);
+						}
+						if (!slice_open) {
+							break;
+						}
+						++box_size.z;
+					}
+
+					for (int z = 0; z < box_size.z; ++z) {
+						for (int x = 0; x < box_size.x; ++x) {
+							int row = i + z * stride_z + x * stride_x;
+							for (int y = 0; y < box_size.y; ++y) {
+								open[row + y] = 0;
+							}
+						}
+					}
+
+					boxes.push_back(Rect3i(pos, box_size));
+				}
+			}
+		}
+	}
+
+private:
+	static bool is_row_open(const Vector<uint8_t> & open, int begin, int length) {
+		for (int y = 0; y < length; ++y) {
+			if (!open[begin + y]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool is_solid(int voxel_id) const {
+		if (library.is_null()) {
+			return voxel_id != 0;
+		}
+		// Voxels the mesher doesn't render don't collide either.
+		// Only baked properties are read, voxel types can be modified by the main thread meanwhile.
+		return voxel_id != 0 && library->get_baked_geometry(voxel_id) != VoxelLibrary::GEOMETRY_NONE;
+	}
+};
+
+struct VoxelTerrain::DestroyBlockMeshAction {
+	VoxelTerrain * terrain;
+	int lod;
+	void operator()(VoxelBlock * block) {
+		terrain->destroy_block_mesh(block);
+		terrain->make_block_dirty(block->pos, lod);
+	}
+};
+
+struct VoxelTerrain::OcclusionVisibilityAction {
+	VoxelTerrain * terrain;
+	uint32_t visit; // Blocks not visited by this search are occluded, or none if 0
+	void operator()(VoxelBlock * block) {
+		terrain->set_block_occluded(block, visit != 0 && block->occlusion_visit != visit);
+	}
+};
+
+struct VoxelTerrain::DestroyBlockCollisionAction {
+	VoxelTerrain * terrain;
+	void operator()(VoxelBlock * block) {
+		terrain->destroy_block_collision(block);
+	}
+};
+
+struct VoxelTerrain::SetBlockSpaceAction {
+	RID space;
+	void operator()(VoxelBlock * block) {
+		if (block->collision_body.is_valid()) {
+			PhysicsServer::get_singleton()->body_set_space(block->collision_body, space);
+		}
+	}
+};
+
+struct VoxelTerrain::SetBlockScenarioAction {
+	RID scenario;
+	void operator()(VoxelBlock * block) {
+		if (block->instance_rid.is_valid()) {
+			VisualServer::get_singleton()->instance_set_scenario(block->instance_rid, scenario);
+		}
+	}
+};
+
+VoxelTerrain::VoxelTerrain(): Node(),
+	_min_y(-4),
+	_max_y(4),
+	_max_unloads_per_frame(64),
+	_render_mode(RENDER_MESH_INSTANCE),
+	_lod_count(1),
+	_lod_hysteresis(1),
+	_collision_radius(1),
+	_prefetch_time(1.f),
+	_mesh_cache_enabled(true),
+	_lod_center_valid(false),
+	_occlusion_culling(false),
+	_occlusion_dirty(false),
+	_occlusion_camera_block_valid(false),
+	_occlusion_visit(0),
+	_occlusion_frames(0),
+	_priority_refresh_index(0),
+	_mesh_pool(NULL),
+	_save_pool(NULL),
+	_collision_pool(NULL),
+	_emerge_pool(NULL)
+{
+
+	for (int i = 0; i < MAX_LOD; ++i) {
+		_lods[i].map = Ref<VoxelMap>(memnew(VoxelMap));
+		_lod_distances[i] = 8;
+	}
+	// Edits are only made at full resolution
+	_lods[0].map->set_observer(this);
 	_mesher = Ref<VoxelMesher>(memnew(VoxelMesher));
 }
 
-// Sorts distance to world origin
-// TODO Use distance to camera
-struct BlockUpdateComparator0 {
-	inline bool operator()(const Vector3i & a, const Vector3i & b) const {
-		return a.length_sq() > b.length_sq();
+VoxelTerrain::~VoxelTerrain() {
+	stop_threads();
+	if (_render_mode == RENDER_VISUAL_SERVER) {
+		// Nodes are freed along with the terrain, but RIDs are not
+		set_render_mode(RENDER_MESH_INSTANCE);
+	}
+	DestroyBlockCollisionAction collision_action;
+	collision_action.terrain = this;
+	_lods[0].map->for_all_blocks(collision_action);
+	free_box_shapes();
+	// The map could outlive us if a script holds it
+	_lods[0].map->set_observer(NULL);
+}
+
+void VoxelTerrain::set_provider(Ref<VoxelProvider> provider) {
+	_provider = provider;
+}
+
+Ref<VoxelProvider> VoxelTerrain::get_provider() {
+	return _provider;
+}
+
+// Blocks loaded this way are not unloaded until a streamer goes over them and leaves
+void VoxelTerrain::force_load_blocks(Vector3i center, Vector3i extents) {
+
+	Vector3i d;
+	for (d.z = -extents.z; d.z <= extents.z; ++d.z) {
+		for (d.x = -extents.x; d.x <= extents.x; ++d.x) {
+			for (d.y = -extents.y; d.y <= extents.y; ++d.y) {
+				Vector3i pos = center + d;
+				if (pos.y < _min_y || pos.y > _max_y) {
+					continue;
+				}
+				_lods[0].load_queue.push(pos, get_block_priority(pos));
+			}
+		}
+	}
+}
+
+void VoxelTerrain::set_max_unloads_per_frame(int count) {
+	ERR_FAIL_COND(count < 1);
+	_max_unloads_per_frame = count;
+}
+
+int VoxelTerrain::get_block_update_count() {
+	int count = 0;
+	for (int i = 0; i < MAX_LOD; ++i) {
+		count += _lods[i].load_queue.size();
+	}
+	return count;
+}
+
+void VoxelTerrain::set_lod_count(int count) {
+	ERR_FAIL_COND(count < 1 || count > MAX_LOD);
+	// Rings are updated next frame
+	_lod_count = count;
+}
+
+void VoxelTerrain::set_lod_distance(int lod, int distance) {
+	ERR_FAIL_COND(lod < 1 || lod >= MAX_LOD);
+	ERR_FAIL_COND(distance < 1);
+	_lod_distances[lod] = distance;
+}
+
+int VoxelTerrain::get_lod_distance(int lod) const {
+	ERR_FAIL_COND_V(lod < 1 || lod >= MAX_LOD, 0);
+	return _lod_distances[lod];
+}
+
+void VoxelTerrain::set_lod_hysteresis(int blocks) {
+	ERR_FAIL_COND(blocks < 0);
+	_lod_hysteresis = blocks;
+}
+
+Ref<VoxelMap> VoxelTerrain::get_lod_map(int lod) {
+	ERR_FAIL_INDEX_V(lod, MAX_LOD, Ref<VoxelMap>());
+	return _lods[lod].map;
+}
+
+void VoxelTerrain::make_block_dirty(Vector3i block_pos, int lod) {
+	make_block_slabs_dirty(block_pos, lod, VoxelMesher::ALL_SLABS);
+}
+
+void VoxelTerrain::make_block_slabs_dirty(Vector3i block_pos, int lod_index, uint32_t slabs) {
+	ERR_FAIL_INDEX(lod_index, MAX_LOD);
+	Lod & lod = _lods[lod_index];
+
+	uint32_t * dirty_slabs = lod.dirty_slabs.getptr(block_pos);
+	if (dirty_slabs) {
+		*dirty_slabs |= slabs;
+	}
+	else if (slabs != VoxelMesher::ALL_SLABS && !lod.dirty_blocks.has(block_pos)) {
+		lod.dirty_slabs.set(block_pos, slabs);
+	}
+	// Otherwise the block is already going to be remeshed entirely
+
+	lod.dirty_blocks.push(block_pos, get_block_priority(block_pos, lod_index));
+}
+
+void VoxelTerrain::make_voxel_dirty(Vector3i pos) {
+
+	const Vector3i block_pos = VoxelMap::voxel_to_block(pos);
+	Vector3i rpos = pos - VoxelMap::block_to_voxel(block_pos);
+
+	// Meshes of neighbor blocks read voxels on our boundary, including diagonals for occlusion,
+	// so they only need an update if the voxel touches them
+	Vector3i min(0, 0, 0);
+	Vector3i max(0, 0, 0);
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (rpos[i] == 0) {
+			min[i] = -1;
+		}
+		else if (rpos[i] == VoxelBlock::SIZE - 1) {
+			max[i] = 1;
+		}
+	}
+
+	Vector3i d;
+	for (d.z = min.z; d.z <= max.z; ++d.z) {
+		for (d.x = min.x; d.x <= max.x; ++d.x) {
+			for (d.y = min.y; d.y <= max.y; ++d.y) {
+				// Faces of the voxel and of those around it can change, in the coordinates of that block
+				const int y = rpos.y - d.y * VoxelBlock::SIZE;
+				const uint32_t slabs = VoxelMesher::get_slabs_in_range(y - 1, MIN(y + 1, VoxelBlock::SIZE - 1));
+				make_block_slabs_dirty(block_pos + d, 0, slabs);
+			}
+		}
+	}
+}
+
+void VoxelTerrain::voxel_changed(Vector3i pos) {
+	make_voxel_dirty(pos);
+	make_block_collision_dirty(VoxelMap::voxel_to_block(pos));
+}
+
+bool VoxelTerrain::is_in_lod_ring(int lod, Vector3i block_pos) const {
+	const Lod & l = _lods[lod];
+	return l.box.contains(block_pos) && !l.hole.contains(block_pos);
+}
+
+bool VoxelTerrain::is_block_known_uniform(int lod, Vector3i block_pos) const {
+	// Blocks out of vertical bounds are never loaded
+	const int scale = 1 << lod;
+	return block_pos.y * scale > _max_y || (block_pos.y + 1) * scale <= _min_y;
+}
+
+// Tells if a block is entirely above or below the surface according to the provider, and which voxel fills it
+bool VoxelTerrain::get_block_surface_hint(int lod, Vector3i block_pos, int & out_voxel) const {
+	VoxelProvider::SurfaceBounds bounds;
+	if (!_provider->get_surface_bounds(block_pos.x, block_pos.z, lod, bounds)) {
+		return false;
+	}
+
+	const int scale = 1 << lod;
+	const int min_y = VoxelMap::block_to_voxel(block_pos).y * scale;
+	const int max_y = min_y + VoxelBlock::SIZE * scale;
+
+	if (min_y >= bounds.max_y) {
+		out_voxel = 0;
+		return true;
+	}
+	if (max_y <= bounds.min_y) {
+		out_voxel = bounds.ground_voxel;
+		return true;
+	}
+	return false;
+}
+
+// Part of a box of blocks that is within vertical bounds
+Rect3i VoxelTerrain::clip_to_height(const Rect3i & box, int lod) const {
+	if (box.is_empty()) {
+		return box;
+	}
+	Rect3i bounds = Rect3i(Vector3i(0, _min_y, 0), Vector3i(1, _max_y - _min_y + 1, 1)).downscaled(1 << lod);
+	bounds.pos.x = box.pos.x;
+	bounds.pos.z = box.pos.z;
+	bounds.size.x = box.size.x;
+	bounds.size.z = box.size.z;
+	return box.clipped(bounds);
+}
+
+bool VoxelTerrain::is_block_meshable(int lod_index, Vector3i block_pos) {
+	const Lod & lod = _lods[lod_index];
+
+	if (lod_index == 0) {
+		// Without LOD, all blocks are rendered
+		if (!lod.box.is_empty() && !lod.box.contains(block_pos)) {
+			return false;
+		}
+	}
+	else if (!is_in_lod_ring(lod_index, block_pos)) {
+		return false;
+	}
+
+	VoxelBlock * block = lod.map->get_block(block_pos);
+	if (block == NULL) {
+		return false;
+	}
+	// No need to know the neighbors to tell there is nothing to render
+	if (get_block_type(block) == BLOCK_EMPTY) {
+		return true;
+	}
+
+	Vector3i d;
+	for (d.z = -1; d.z < 2; ++d.z) {
+		for (d.x = -1; d.x < 2; ++d.x) {
+			for (d.y = -1; d.y < 2; ++d.y) {
+				Vector3i npos = block_pos + d;
+				// Blocks of other levels are not needed, they read as empty
+				if (lod_index > 0 && !is_in_lod_ring(lod_index, npos)) {
+					continue;
+				}
+				if (!lod.map->has_block(npos) && !is_block_known_uniform(lod_index, npos)) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+VoxelTerrain::BlockType VoxelTerrain::get_block_type(VoxelBlock * block) const {
+
+	int voxel_id = block->get_uniform_voxel();
+	if (voxel_id < 0) {
+		return BLOCK_MIXED;
+	}
+	if (voxel_id == 0) {
+		// Air
+		return BLOCK_EMPTY;
+	}
+
+	Ref<VoxelLibrary> library = _mesher->get_library();
+	if (library.is_null() || !library->has_voxel(voxel_id)) {
+		// The mesher would skip all voxels
+		return BLOCK_EMPTY;
+	}
+
+	const Voxel & voxel = library->get_voxel_const(voxel_id);
+	if (voxel.get_model_vertices().size() != 0) {
+		return BLOCK_MIXED;
+	}
+
+	bool has_faces = false;
+	for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+		if (!voxel.is_face_visible(side)) {
+			// Faces of the same voxel type facing it would show up inside the block
+			return BLOCK_MIXED;
+		}
+		if (voxel.get_model_side_vertices(side).size() != 0) {
+			has_faces = true;
+		}
+	}
+
+	return has_faces ? BLOCK_SOLID : BLOCK_EMPTY;
+}
+
+// True if faces of a solid block are all hidden by its neighbors
+bool VoxelTerrain::is_solid_block_occluded(VoxelMap & map, VoxelBlock * block) const {
+
+	const VoxelLibrary & library = **_mesher->get_library();
+	const int voxel_id = block->get_uniform_voxel();
+
+	for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+		VoxelBlock * nblock = map.get_block(block->pos + g_side_directions[side]);
+		if (nblock == NULL) {
+			// Reads as the default voxel
+			return false;
+		}
+
+		int nvoxel_id = nblock->get_uniform_voxel();
+		if (nvoxel_id == voxel_id) {
+			continue;
+		}
+		// Missing voxel types are baked as transparent
+		if (nvoxel_id < 0
+				|| library.get_baked_transparent(nvoxel_id)
+				|| (library.get_baked_hidden_faces(nvoxel_id) & (1 << Voxel::opposite(side)))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void VoxelTerrain::get_mesh_neighborhood(int lod_index, Vector3i block_pos, Ref<VoxelBuffer> out_blocks[27]) {
+	_lods[lod_index].map->get_neighborhood(block_pos, out_blocks);
+
+	if (!is_in_lod_ring(lod_index, block_pos)) {
+		return;
+	}
+
+	// Neighbors rendered by another level are left out so they read as empty.
+	// This closes the surface along the seam, instead of leaving gaps where levels don't match.
+	unsigned int i = 0;
+	Vector3i d;
+	for (d.z = -1; d.z < 2; ++d.z) {
+		for (d.x = -1; d.x < 2; ++d.x) {
+			for (d.y = -1; d.y < 2; ++d.y) {
+				if (!is_in_lod_ring(lod_index, block_pos + d)) {
+					out_blocks[i] = Ref<VoxelBuffer>();
+				}
+				++i;
+			}
+		}
+	}
+}
+
+void VoxelTerrain::update_dirty_blocks() {
+	_scheduler.begin_stage(VoxelFrameScheduler::STAGE_MESHING);
+
+	for (int lod_index = 0; lod_index < MAX_LOD && !_scheduler.is_over_budget(); ++lod_index) {
+		Lod & lod = _lods[lod_index];
+
+		// Closest blocks first
+		while (!lod.dirty_blocks.empty()) {
+			Vector3i block_pos = lod.dirty_blocks.top();
+			lod.dirty_blocks.pop();
+			if (is_block_meshable(lod_index, block_pos)) {
+				update_block_mesh(block_pos, lod_index);
+			}
+			else {
+				lod.dirty_slabs.erase(block_pos);
+			}
+			if (_scheduler.is_over_budget()) {
+				break;
+			}
+		}
+	}
+
+	_scheduler.end_stage();
+}
+
+void VoxelTerrain::add_viewer(Node * viewer) {
+	ERR_FAIL_NULL(viewer);
+	ERR_FAIL_COND(viewer->cast_to<Spatial>() == NULL);
+
+	uint32_t id = viewer->get_instance_ID();
+	for (int i = 0; i < _viewers.size(); ++i) {
+		if (_viewers[i].instance_id == id) {
+			return;
+		}
+	}
+
+	Viewer v;
+	v.instance_id = id;
+	v.has_position = false;
+	_viewers.push_back(v);
+}
+
+void VoxelTerrain::remove_viewer(Node * viewer) {
+	ERR_FAIL_NULL(viewer);
+
+	uint32_t id = viewer->get_instance_ID();
+	for (int i = 0; i < _viewers.size(); ++i) {
+		if (_viewers[i].instance_id == id) {
+			set_viewer_box(i, Rect3i());
+			set_viewer_prefetch_box(i, Rect3i());
+			_viewers.remove(i);
+			return;
+		}
+	}
+}
+
+struct VoxelTerrain::RefBlockAction {
+	VoxelTerrain * terrain;
+	_FORCE_INLINE_ void operator()(Vector3i block_pos) { terrain->ref_block(block_pos); }
+};
+
+struct VoxelTerrain::UnrefBlockAction {
+	VoxelTerrain * terrain;
+	_FORCE_INLINE_ void operator()(Vector3i block_pos) { terrain->unref_block(block_pos); }
+};
+
+void VoxelTerrain::set_viewer_box(int viewer_index, const Rect3i & box) {
+	set_streaming_box(_viewers[viewer_index].box, box);
+}
+
+void VoxelTerrain::set_viewer_prefetch_box(int viewer_index, const Rect3i & box) {
+	set_streaming_box(_viewers[viewer_index].prefetch_box, box);
+}
+
+// Blocks in the box are kept loaded, if they are within vertical bounds
+void VoxelTerrain::set_streaming_box(Rect3i & current_box, const Rect3i & requested_box) {
+	const Rect3i box = clip_to_height(requested_box, 0);
+	if (current_box == box) {
+		return;
+	}
+
+	// Only blocks that entered or left the box are visited
+	UnrefBlockAction unref_action;
+	unref_action.terrain = this;
+	Rect3i::difference(current_box, box, unref_action);
+
+	RefBlockAction ref_action;
+	ref_action.terrain = this;
+	Rect3i::difference(box, current_box, ref_action);
+
+	current_box = box;
+}
+
+void VoxelTerrain::ref_block(Vector3i block_pos) {
+	int * refcount = _block_refcounts.getptr(block_pos);
+	if (refcount) {
+		++(*refcount);
+		return;
+	}
+	_block_refcounts.set(block_pos, 1);
+	if (!_lods[0].map->has_block(block_pos)) {
+		_lods[0].load_queue.push(block_pos, get_block_priority(block_pos));
+	}
+}
+
+void VoxelTerrain::unref_block(Vector3i block_pos) {
+	int * refcount = _block_refcounts.getptr(block_pos);
+	ERR_FAIL_COND(refcount == NULL);
+	--(*refcount);
+	if (*refcount > 0) {
+		return;
+	}
+	_block_refcounts.erase(block_pos);
+	_lods[0].load_queue.erase(block_pos);
+	if (_lods[0].map->has_block(block_pos)) {
+		_lods[0].unload_queue.push_back(block_pos);
+	}
+}
+
+// Visits blocks that entered or left the ring of a level
+struct VoxelTerrain::LodRingAction {
+	VoxelTerrain * terrain;
+	int lod;
+	Rect3i old_box;
+	Rect3i old_hole;
+	Rect3i new_box;
+	Rect3i new_hole;
+
+	_FORCE_INLINE_ void operator()(Vector3i block_pos) {
+		bool was_in = old_box.contains(block_pos) && !old_hole.contains(block_pos);
+		bool is_in = new_box.contains(block_pos) && !new_hole.contains(block_pos);
+		// Holes are inside boxes, so a block that changed is only visited once
+		if (was_in != is_in) {
+			terrain->lod_ring_changed(lod, block_pos, is_in);
+		}
+	}
+};
+
+void VoxelTerrain::update_lods(int main_viewer_index, int view_distance) {
+
+	Rect3i boxes[MAX_LOD];
+
+	if (main_viewer_index >= 0 && _lod_count > 1) {
+
+		Vector3i block_pos = _viewers[main_viewer_index].block_pos;
+		Vector3i d = block_pos - _lod_center;
+		if (!_lod_center_valid || MAX(ABS(d.x), MAX(ABS(d.y), ABS(d.z))) > _lod_hysteresis) {
+			_lod_center = block_pos;
+			_lod_center_valid = true;
+		}
+
+		for (int lod = 0; lod < _lod_count; ++lod) {
+			Vector3i center(_lod_center.x >> lod, _lod_center.y >> lod, _lod_center.z >> lod);
+			int r = lod == 0 ? view_distance : _lod_distances[lod];
+			Rect3i box = Rect3i::from_center_extents(center, Vector3i(r, r, r));
+			if (lod > 0) {
+				// The previous level must fit inside, with at least one block around it
+				box = Rect3i::get_bounding_box(box, boxes[lod - 1].downscaled(2).padded(1));
+			}
+			// So the hole of the next level falls on whole blocks of this one
+			boxes[lod] = box.snapped(2);
+		}
+
+		// Blocks on the edge of level 0 need their neighbors to be meshed
+		set_viewer_box(main_viewer_index, boxes[0].padded(1));
+	}
+	else {
+		_lod_center_valid = false;
+	}
+
+	for (int lod = 0; lod < MAX_LOD; ++lod) {
+		// Clipping both the same way keeps the hole inside the box
+		Rect3i hole = lod > 0 ? boxes[lod - 1].downscaled(2) : Rect3i();
+		set_lod_ring(lod, clip_to_height(boxes[lod], lod), clip_to_height(hole, lod));
+	}
+}
+
+void VoxelTerrain::set_lod_ring(int lod_index, Rect3i box, Rect3i hole) {
+	Lod & lod = _lods[lod_index];
+
+	if (box.is_empty()) {
+		box = Rect3i();
+		hole = Rect3i();
+	}
+	if (lod.box == box && lod.hole == hole) {
+		return;
+	}
+
+	LodRingAction action;
+	action.terrain = this;
+	action.lod = lod_index;
+	action.old_box = lod.box;
+	action.old_hole = lod.hole;
+	action.new_box = box;
+	action.new_hole = hole;
+
+	// Only the parts of boxes and holes that moved are visited
+	Rect3i::difference(lod.box, box, action);
+	Rect3i::difference(box, lod.box, action);
+	Rect3i::difference(lod.hole, hole, action);
+	Rect3i::difference(hole, lod.hole, action);
+
+	lod.box = box;
+	lod.hole = hole;
+}
+
+void VoxelTerrain::lod_ring_changed(int lod_index, Vector3i block_pos, bool entered) {
+	Lod & lod = _lods[lod_index];
+
+	// Blocks of level 0 are loaded by streamers, but they stop being rendered when they leave the ring
+	if (entered) {
+		if (lod_index > 0 && !lod.map->has_block(block_pos)) {
+			lod.load_queue.push(block_pos, get_block_priority(block_pos, lod_index));
+		}
+	}
+	else {
+		lod.load_queue.erase(block_pos);
+		VoxelEmergeTask ** emerge_task = lod.pending_emerge_tasks.getptr(block_pos);
+		if (emerge_task) {
+			(*emerge_task)->cancelled = true;
+			lod.pending_emerge_tasks.erase(block_pos);
+		}
+		if (lod.map->has_block(block_pos)) {
+			lod.unload_queue.push_back(block_pos);
+		}
+	}
+
+	// Neighbors now see this block as part of their ring or not
+	Vector3i d;
+	for (d.z = -1; d.z < 2; ++d.z) {
+		for (d.x = -1; d.x < 2; ++d.x) {
+			for (d.y = -1; d.y < 2; ++d.y) {
+				Vector3i npos = block_pos + d;
+				if (lod.map->has_block(npos)) {
+					make_block_dirty(npos, lod_index);
+				}
+			}
+		}
+	}
+}
+
+// True if the area covered by the block is displayed, either by the block itself,
+// or by blocks of the previous level if it's in the hole
+bool VoxelTerrain::is_lod_area_rendered(int lod_index, Vector3i block_pos) {
+	const Lod & lod = _lods[lod_index];
+
+	if (lod_index > 0 && lod.hole.contains(block_pos)) {
+		Vector3i d;
+		for (d.z = 0; d.z < 2; ++d.z) {
+			for (d.x = 0; d.x < 2; ++d.x) {
+				for (d.y = 0; d.y < 2; ++d.y) {
+					if (!is_lod_area_rendered(lod_index - 1, block_pos * 2 + d)) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	return is_block_meshable(lod_index, block_pos)
+		&& !lod.dirty_blocks.has(block_pos)
+		&& !lod.pending_mesh_tasks.has(block_pos);
+}
+
+void VoxelTerrain::unload_blocks() {
+
+	VoxelSaveTask * save_task = NULL;
+
+	int count = 0;
+	for (int lod_index = 0; lod_index < MAX_LOD; ++lod_index) {
+		Lod & lod = _lods[lod_index];
+		Vector<Vector3i> postponed;
+
+		while (!lod.unload_queue.empty() && count < _max_unloads_per_frame) {
+			Vector3i block_pos = lod.unload_queue[lod.unload_queue.size() - 1];
+			lod.unload_queue.resize(lod.unload_queue.size() - 1);
+
+			bool rendered = lod_index == 0 ? lod.box.is_empty() || lod.box.contains(block_pos) : is_in_lod_ring(lod_index, block_pos);
+			bool loaded = lod_index == 0 ? _block_refcounts.has(block_pos) : rendered;
+
+			// Might have been requested again in the meantime
+			if (loaded && rendered) {
+				continue;
+			}
+
+			// When another level takes over, wait until it's ready so no hole appears in the meantime
+			bool replaced = true;
+			if (lod_index > 0 && lod.hole.contains(block_pos)) {
+				replaced = is_lod_area_rendered(lod_index, block_pos);
+			}
+			else if (lod_index + 1 < MAX_LOD) {
+				Vector3i parent_pos(block_pos.x >> 1, block_pos.y >> 1, block_pos.z >> 1);
+				if (is_in_lod_ring(lod_index + 1, parent_pos)) {
+					replaced = is_lod_area_rendered(lod_index + 1, parent_pos);
+				}
+			}
+			if (!replaced) {
+				postponed.push_back(block_pos);
+				continue;
+			}
+
+			if (loaded) {
+				// Still needed by a streamer, only its mesh goes away
+				VoxelBlock * block = lod.map->get_block(block_pos);
+				if (block) {
+					set_block_mesh(block, lod_index, NULL);
+				}
+				VoxelMeshTask ** pending_task = lod.pending_mesh_tasks.getptr(block_pos);
+				if (pending_task) {
+					(*pending_task)->cancelled = true;
+					lod.pending_mesh_tasks.erase(block_pos);
+				}
+			}
+			else {
+				unload_block(block_pos, lod_index, &save_task);
+			}
+			++count;
+		}
+
+		for (int i = 0; i < postponed.size(); ++i) {
+			lod.unload_queue.push_back(postponed[i]);
+		}
+	}
+
+	if (save_task) {
+		_save_pool->push(save_task);
+	}
+
+	pop_completed_saves();
+}
+
+void VoxelTerrain::pop_completed_saves() {
+	Vector<VoxelTask*> completed_tasks;
+	_save_pool->pop_completed(completed_tasks);
+
+	for (int i = 0; i < completed_tasks.size(); ++i) {
+		VoxelSaveTask * task = static_cast<VoxelSaveTask*>(completed_tasks[i]);
+		for (int j = 0; j < task->positions.size(); ++j) {
+			// The block may have been unloaded again with newer voxels, still being saved
+			const Ref<VoxelBuffer> * saving = _saving_blocks.getptr(task->positions[j]);
+			if (saving && *saving == task->buffers[j]) {
+				_saving_blocks.erase(task->positions[j]);
+			}
+		}
+		memdelete(task);
+	}
+}
+
+struct VoxelTerrain::SaveModifiedBlockAction {
+	VoxelTerrain * terrain;
+	VoxelSaveTask * task;
+	void operator()(VoxelBlock * block) {
+		if (!block->modified) {
+			return;
+		}
+		task->positions.push_back(block->pos);
+		task->buffers.push_back(block->voxels);
+		terrain->_saving_blocks.set(block->pos, block->voxels);
+		// Editing voxels again copies them first, so the task can keep reading these
+		block->modified = false;
+	}
+};
+
+// Saves blocks that are still loaded, so their edits are not lost when the terrain goes away
+void VoxelTerrain::save_modified_blocks() {
+	if (_save_pool == NULL || _provider.is_null()) {
+		return;
+	}
+
+	SaveModifiedBlockAction action;
+	action.terrain = this;
+	action.task = memnew(VoxelSaveTask);
+	action.task->provider = _provider;
+	_lods[0].map->for_all_blocks(action);
+
+	if (action.task->positions.empty()) {
+		memdelete(action.task);
+	}
+	else {
+		_save_pool->push(action.task);
+	}
+}
+
+void VoxelTerrain::unload_block(Vector3i block_pos, int lod_index, VoxelSaveTask ** save_task) {
+	Lod & lod = _lods[lod_index];
+
+	VoxelBlock * block = lod.map->get_block(block_pos);
+	if (block == NULL) {
+		return;
+	}
+
+	if (block->modified && _provider.is_valid()) {
+		if (*save_task == NULL) {
+			*save_task = memnew(VoxelSaveTask);
+			(*save_task)->provider = _provider;
+		}
+		// The block is about to be deleted so we can give away its voxels
+		(*save_task)->positions.push_back(block_pos);
+		(*save_task)->buffers.push_back(block->voxels);
+		_saving_blocks.set(block_pos, block->voxels);
+	}
+
+	destroy_block_mesh(block);
+	forget_block_slabs(lod_index, block_pos);
+	lod.dirty_slabs.erase(block_pos);
+
+	VoxelMeshTask ** pending_task = lod.pending_mesh_tasks.getptr(block_pos);
+	if (pending_task) {
+		(*pending_task)->cancelled = true;
+		lod.pending_mesh_tasks.erase(block_pos);
+	}
+
+	if (lod_index == 0) {
+		_occlusion_dirty = true;
+		destroy_block_collision(block);
+		VoxelCollisionTask ** collision_task = _pending_collision_tasks.getptr(block_pos);
+		if (collision_task) {
+			(*collision_task)->cancelled = true;
+			_pending_collision_tasks.erase(block_pos);
+		}
+	}
+
+	lod.map->remove_block(block_pos);
+}
+
+void VoxelTerrain::update_viewers() {
+
+	bool moved = false;
+	const float delta = get_process_delta_time();
+
+	// LOD rings follow the first streamer
+	int main_viewer_index = -1;
+	int main_view_distance = 0;
+
+	for (int i = 0; i < _viewers.size(); ++i) {
+		Viewer & viewer = _viewers[i];
+
+		Object * obj = ObjectDB::get_instance(viewer.instance_id);
+		Spatial * spatial = obj ? obj->cast_to<Spatial>() : NULL;
+		if (spatial == NULL) {
+			// The viewer was deleted
+			set_viewer_box(i, Rect3i());
+			set_viewer_prefetch_box(i, Rect3i());
+			_viewers.remove(i);
+			--i;
+			moved = true;
+			continue;
+		}
+
+		// The terrain is not a Spatial, so blocks are in world space
+		Vector3 position = spatial->get_global_transform().origin;
+		if (viewer.has_position && delta > 0) {
+			Vector3 instant_velocity = (position - viewer.position) / delta;
+			viewer.velocity += (instant_velocity - viewer.velocity) * VELOCITY_SMOOTHING;
+		}
+		viewer.position = position;
+		viewer.has_position = true;
+
+		Camera * camera = spatial->cast_to<Camera>();
+		if (camera) {
+			viewer.frustum = camera->get_frustum();
+			// Cameras turn a lot more often than they cross blocks
+			moved = true;
+		}
+
+		Vector3i block_pos = VoxelMap::voxel_to_block(Vector3i(viewer.position));
+		if (!(block_pos == viewer.block_pos)) {
+			viewer.block_pos = block_pos;
+			moved = true;
+		}
+
+		VoxelTerrainStreamer * streamer = spatial->cast_to<VoxelTerrainStreamer>();
+		if (streamer) {
+			int d = streamer->get_view_distance();
+			if (main_viewer_index < 0) {
+				main_viewer_index = i;
+				main_view_distance = d;
+			}
+			// When LOD is enabled, the box of the main streamer is aligned with the rings
+			if (main_viewer_index != i || _lod_count == 1) {
+				set_viewer_box(i, Rect3i::from_center_extents(block_pos, Vector3i(d, d, d)));
+			}
+
+			// Load blocks where the viewer will be if it keeps going, but not farther than it can see
+			Rect3i prefetch_box;
+			if (_prefetch_time > 0) {
+				Vector3 offset = viewer.velocity * _prefetch_time;
+				const float max_distance = d * VoxelBlock::SIZE;
+				if (offset.length_squared() > max_distance * max_distance) {
+					offset = offset.normalized() * max_distance;
+				}
+				Vector3i predicted_block_pos = VoxelMap::voxel_to_block(Vector3i(viewer.position + offset));
+				if (!(predicted_block_pos == block_pos)) {
+					prefetch_box = Rect3i::from_center_extents(predicted_block_pos, Vector3i(d, d, d));
+				}
+			}
+			if (!(prefetch_box == viewer.prefetch_box)) {
+				// Blocks that are not on the way anymore are dropped with their pending work
+				set_viewer_prefetch_box(i, prefetch_box);
+				moved = true;
+			}
+		}
+	}
+
+	update_lods(main_viewer_index, main_view_distance);
+
+	if (moved) {
+		// Start over the incremental refresh
+		const VoxelPriorityQueue<Vector3i, Vector3iHasher> & queue = _lods[0].load_queue;
+		_priority_refresh_keys.resize(queue.size());
+		for (int i = 0; i < queue.size(); ++i) {
+			_priority_refresh_keys[i] = queue.get_key(i);
+		}
+		_priority_refresh_index = 0;
+	}
+}
+
+// Squared distances get large quickly, far blocks share the lowest priority instead of overflowing
+static int distance_to_priority(float d2) {
+	// Largest float below 2^31
+	const float max_priority = 2147483520.f;
+	return Math::fast_ftoi(MIN(d2, max_priority));
+}
+
+int VoxelTerrain::get_block_priority(Vector3i block_pos, int lod) const {
+
+	const int scale = 1 << lod;
+	const float half_size = 0.5f * VoxelBlock::SIZE * scale;
+	const Vector3 center = (VoxelMap::block_to_voxel(block_pos) * scale).to_vec3() + Vector3(half_size, half_size, half_size);
+
+	if (_viewers.empty()) {
+		// Default to the world origin
+		return distance_to_priority(center.length_squared());
+	}
+
+	// Radius of the bounding sphere of a block
+	const float radius = half_size * 1.7320508f;
+
+	float best_d2 = -1;
+
+	for (int i = 0; i < _viewers.size(); ++i) {
+		const Viewer & viewer = _viewers[i];
+
+		float d2 = center.distance_squared_to(viewer.position);
+
+		if (!viewer.frustum.empty()) {
+			bool in_view = true;
+			for (int j = 0; j < viewer.frustum.size(); ++j) {
+				if (viewer.frustum[j].distance_to(center) > radius) {
+					in_view = false;
+					break;
+				}
+			}
+			if (in_view) {
+				d2 /= FRUSTUM_PRIORITY_FACTOR * FRUSTUM_PRIORITY_FACTOR;
+			}
+		}
+
+		if (best_d2 < 0 || d2 < best_d2) {
+			best_d2 = d2;
+		}
+	}
+
+	if (lod == 0 && is_block_prefetched_only(block_pos)) {
+		best_d2 *= PREFETCH_PRIORITY_FACTOR * PREFETCH_PRIORITY_FACTOR;
+	}
+
+	return distance_to_priority(best_d2);
+}
+
+// True if the block is only wanted because a viewer is heading towards it
+bool VoxelTerrain::is_block_prefetched_only(Vector3i block_pos) const {
+	bool prefetched = false;
+	for (int i = 0; i < _viewers.size(); ++i) {
+		const Viewer & viewer = _viewers[i];
+		if (viewer.box.contains(block_pos)) {
+			return false;
+		}
+		if (viewer.prefetch_box.contains(block_pos)) {
+			prefetched = true;
+		}
+	}
+	return prefetched;
+}
+
+void VoxelTerrain::refresh_block_priorities() {
+
+	VoxelPriorityQueue<Vector3i, Vector3iHasher> & queue = _lods[0].load_queue;
+
+	const int end = MIN(_priority_refresh_index + PRIORITY_REFRESH_BATCH_SIZE, _priority_refresh_keys.size());
+	for (; _priority_refresh_index < end; ++_priority_refresh_index) {
+		const Vector3i block_pos = _priority_refresh_keys[_priority_refresh_index];
+		// It may have been loaded or dropped since
+		if (queue.has(block_pos)) {
+			queue.push(block_pos, get_block_priority(block_pos));
+		}
+	}
+
+	if (_priority_refresh_index >= _priority_refresh_keys.size()) {
+		_priority_refresh_keys.clear();
+		_priority_refresh_index = 0;
+	}
+}
+
+void VoxelTerrain::_notification(int p_what) {
+
+	switch (p_what) {
+
+	case NOTIFICATION_ENTER_TREE:
+		start_threads();
+		set_blocks_scenario(get_scenario());
+		set_blocks_space(get_space());
+		set_process(true);
+		break;
+
+	case NOTIFICATION_PROCESS:
+		_process();
+		break;
+
+	case NOTIFICATION_EXIT_TREE:
+		stop_threads();
+		set_blocks_scenario(RID());
+		set_blocks_space(RID());
+		break;
+
+	default:
+		break;
+	}
+}
+
+void VoxelTerrain::_process() {
+	_scheduler.begin_frame();
+	_stats.frame_time.add(_scheduler.get_frame_time_usec());
+	update_viewers();
+	refresh_block_priorities();
+	unload_blocks();
+	update_blocks();
+	update_dirty_blocks();
+	apply_mesh_updates();
+	update_occlusion_culling();
+	update_collisions();
+	_stats.end_frame();
+}
+
+void VoxelTerrain::start_threads() {
+	if (_mesh_pool == NULL) {
+		// Leave one core to the main thread
+		_mesh_pool = memnew(VoxelThreadPool(OS::get_singleton()->get_processor_count() - 1));
+		for (int i = 0; i < _mesh_pool->get_thread_count(); ++i) {
+			_mesh_scratches.push_back(memnew(VoxelMesher::Scratch));
+		}
+	}
+	if (_save_pool == NULL) {
+		_save_pool = memnew(VoxelThreadPool(1));
+	}
+	if (_collision_pool == NULL) {
+		_collision_pool = memnew(VoxelThreadPool(1));
+	}
+	if (_emerge_pool == NULL) {
+		_emerge_pool = memnew(VoxelThreadPool(1));
+	}
+}
+
+void VoxelTerrain::stop_threads() {
+	if (_mesh_pool) {
+		// Waits for running tasks, and deletes all of them
+		memdelete(_mesh_pool);
+		_mesh_pool = NULL;
+		for (int i = 0; i < _mesh_scratches.size(); ++i) {
+			memdelete(_mesh_scratches[i]);
+		}
+		_mesh_scratches.clear();
+		// Meshes of blocks that were waiting are built again when threads restart
+		for (int i = 0; i < MAX_LOD; ++i) {
+			Lod & lod = _lods[i];
+			const Vector3i * key = NULL;
+			while ((key = lod.pending_mesh_tasks.next(key))) {
+				make_block_dirty(*key, i);
+			}
+			lod.pending_mesh_tasks.clear();
+		}
+		for (int i = 0; i < _completed_mesh_tasks.size(); ++i) {
+			VoxelMeshTask * task = static_cast<VoxelMeshTask*>(_completed_mesh_tasks[i]);
+			make_block_dirty(task->block_pos, task->lod);
+			memdelete(task);
+		}
+		_completed_mesh_tasks.clear();
+	}
+	if (_save_pool) {
+		// Don't lose modifications
+		save_modified_blocks();
+		_save_pool->flush();
+		pop_completed_saves();
+		memdelete(_save_pool);
+		_save_pool = NULL;
+		_saving_blocks.clear();
+	}
+	if (_collision_pool) {
+		memdelete(_collision_pool);
+		_collision_pool = NULL;
+		// Shapes of blocks that were waiting are built again when threads restart
+		const Vector3i * key = NULL;
+		while ((key = _pending_collision_tasks.next(key))) {
+			_collision_dirty_blocks.push(*key, get_block_priority(*key));
+		}
+		_pending_collision_tasks.clear();
+		for (int i = 0; i < _completed_collision_tasks.size(); ++i) {
+			VoxelCollisionTask * task = static_cast<VoxelCollisionTask*>(_completed_collision_tasks[i]);
+			_collision_dirty_blocks.push(task->block_pos, get_block_priority(task->block_pos));
+			memdelete(task);
+		}
+		_completed_collision_tasks.clear();
+	}
+	if (_emerge_pool) {
+		memdelete(_emerge_pool);
+		_emerge_pool = NULL;
+		// Blocks that were waiting are requested again when threads restart
+		for (int i = 0; i < MAX_LOD; ++i) {
+			Lod & lod = _lods[i];
+			const Vector3i * key = NULL;
+			while ((key = lod.pending_emerge_tasks.next(key))) {
+				lod.load_queue.push(*key, get_block_priority(*key, i));
+			}
+			lod.pending_emerge_tasks.clear();
+		}
+		// Those were still pending too
+		for (int i = 0; i < _completed_emerge_tasks.size(); ++i) {
+			memdelete(_completed_emerge_tasks[i]);
+		}
+		_completed_emerge_tasks.clear();
+	}
+}
+
+void VoxelTerrain::update_blocks() {
+	_scheduler.begin_stage(VoxelFrameScheduler::STAGE_GENERATION);
+
+	apply_emerged_blocks();
+
+	while (true) {
+		//printf("Remaining: %i\n", get_block_update_count());
+
+		// TODO Move this to a thread
+		// TODO Have VoxelTerrainGenerator in C++
+
+		// Levels are loaded together, closest blocks first
+		int lod_index = -1;
+		for (int i = 0; i < MAX_LOD; ++i) {
+			const VoxelPriorityQueue<Vector3i, Vector3iHasher> & queue = _lods[i].load_queue;
+			if (!queue.empty() && (lod_index < 0 || queue.top_priority() < _lods[lod_index].load_queue.top_priority())) {
+				lod_index = i;
+			}
+		}
+		if (lod_index < 0) {
+			break;
+		}
+		Lod & lod = _lods[lod_index];
+
+		// Get request
+		Vector3i block_pos = lod.load_queue.top();
+
+		// Priorities are not all up to date if viewers moved, so check again before committing to it
+		int priority = get_block_priority(block_pos, lod_index);
+		if (priority > lod.load_queue.top_priority()) {
+			lod.load_queue.push(block_pos, priority);
+			continue;
+		}
+
+		// Pop request
+		lod.load_queue.pop();
+
+		const Ref<VoxelBuffer> * saving = lod_index == 0 ? _saving_blocks.getptr(block_pos) : NULL;
+
+		if (saving && !lod.map->has_block(block_pos)) {
+			// Edits are still on their way to the provider, which would return older voxels.
+			// Editing them again copies them first, so the save task is not affected.
+			lod.map->set_block_buffer(block_pos, *saving);
+			make_block_collision_dirty(block_pos);
+		}
+		else if (!lod.map->has_block(block_pos)) {
+			// Create buffer
+			if(!_provider.is_null()) {
+				Ref<VoxelBuffer> buffer_ref = Ref<VoxelBuffer>(memnew(VoxelBuffer));
+				const Vector3i block_size(VoxelBlock::SIZE, VoxelBlock::SIZE, VoxelBlock::SIZE);
+				buffer_ref->create(block_size.x, block_size.y, block_size.z);
+
+				int uniform_voxel;
+				if (get_block_surface_hint(lod_index, block_pos, uniform_voxel)) {
+					// Sky or deep ground, voxels are known without asking. Uniform channels take no memory.
+					buffer_ref->clear_channel(0, uniform_voxel);
+				}
+				else if (lod_index > 0 && _emerge_pool) {
+					// Stored by apply_emerged_blocks() once the worker is done
+					if (!lod.pending_emerge_tasks.has(block_pos)) {
+						VoxelEmergeTask * task = memnew(VoxelEmergeTask);
+						task->provider = _provider;
+						task->block_pos = block_pos;
+						task->lod = lod_index;
+						task->buffer = buffer_ref;
+						task->priority = priority;
+						lod.pending_emerge_tasks.set(block_pos, task);
+						_emerge_pool->push(task);
+					}
+					continue;
+				}
+				else {
+					// Query voxel provider
+					uint64_t time_before = OS::get_singleton()->get_ticks_usec();
+					if (lod_index == 0) {
+						_provider->emerge_block(buffer_ref, block_pos);
+					}
+					else {
+						_provider->emerge_block_lod(buffer_ref, block_pos, lod_index);
+					}
+					_stats.emerge_time.add(OS::get_singleton()->get_ticks_usec() - time_before);
+				}
+				_stats.blocks_loaded.add(1);
+
+				// Check script return
+				ERR_CONTINUE(!(buffer_ref->get_size() == block_size));
+
+				// Store buffer
+				lod.map->set_block_buffer(block_pos, buffer_ref);
+
+				if (lod_index == 0) {
+					make_block_collision_dirty(block_pos);
+				}
+			}
+		}
+
+		make_blocks_around_dirty(block_pos, lod_index);
+
+		if (_scheduler.is_over_budget()) {
+			break;
+		}
+	}
+
+	_scheduler.end_stage();
+}
+
+void VoxelTerrain::apply_emerged_blocks() {
+	if (_emerge_pool == NULL) {
+		return;
+	}
+
+	// Results we didn't have time for last frame come first
+	_emerge_pool->pop_completed(_completed_emerge_tasks);
+
+	int i = 0;
+	while (i < _completed_emerge_tasks.size() && !_scheduler.is_over_budget()) {
+		VoxelEmergeTask * task = static_cast<VoxelEmergeTask*>(_completed_emerge_tasks[i]);
+		++i;
+		Lod & lod = _lods[task->lod];
+
+		VoxelEmergeTask ** current_task = lod.pending_emerge_tasks.getptr(task->block_pos);
+		if (current_task && *current_task == task) {
+			lod.pending_emerge_tasks.erase(task->block_pos);
+			_stats.emerge_time.add(task->emerge_time);
+			_stats.blocks_loaded.add(1);
+
+			// Check script return
+			if (task->buffer->get_size() == Vector3i(VoxelBlock::SIZE, VoxelBlock::SIZE, VoxelBlock::SIZE)) {
+				lod.map->set_block_buffer(task->block_pos, task->buffer);
+				make_blocks_around_dirty(task->block_pos, task->lod);
+			}
+			else {
+				ERR_PRINT("Emerged block has the wrong size");
+			}
+		}
+
+		memdelete(task);
+	}
+
+	// Keep the rest for next frame
+	int remaining = _completed_emerge_tasks.size() - i;
+	for (int j = 0; j < remaining; ++j) {
+		_completed_emerge_tasks[j] = _completed_emerge_tasks[i + j];
+	}
+	_completed_emerge_tasks.resize(remaining);
+}
+
+void VoxelTerrain::make_blocks_around_dirty(Vector3i block_pos, int lod_index) {
+	// Blocks around may now be meshable. Meshing is scheduled in its own stage.
+	Vector3i ndir;
+	for (ndir.z = -1; ndir.z < 2; ++ndir.z) {
+		for (ndir.x = -1; ndir.x < 2; ++ndir.x) {
+			for (ndir.y = -1; ndir.y < 2; ++ndir.y) {
+				Vector3i npos = block_pos + ndir;
+				if (is_block_meshable(lod_index, npos)) {
+					make_block_dirty(npos, lod_index);
+				}
+			}
+		}
+	}
+}
+
+void VoxelTerrain::update_block_mesh(Vector3i block_pos, int lod_index) {
+	ERR_FAIL_COND(_mesh_pool == NULL);
+
+	Lod & lod = _lods[lod_index];
+
+	uint32_t dirty_slabs = VoxelMesher::ALL_SLABS;
+	const uint32_t * pending_slabs = lod.dirty_slabs.getptr(block_pos);
+	if (pending_slabs) {
+		dirty_slabs = *pending_slabs;
+		lod.dirty_slabs.erase(block_pos);
+	}
+	// What is done here sees the latest voxels
+	lod.dirty_blocks.erase(block_pos);
+
+	VoxelBlock * block = lod.map->get_block(block_pos);
+	if (block == NULL) {
+		return;
+	}
+
+	VoxelMeshTask ** existing_task = lod.pending_mesh_tasks.getptr(block_pos);
+	if (existing_task) {
+		// Superseded, its result will be ignored, so what it had to rebuild is still to do
+		dirty_slabs |= (*existing_task)->dirty_slabs;
+		(*existing_task)->cancelled = true;
+		lod.pending_mesh_tasks.erase(block_pos);
+	}
+
+	// Only references are taken here. Gathering neighbor voxels and building the mesh
+	// (that part is the most CPU-intensive) are done by the worker.
+	Ref<VoxelBuffer> blocks[27];
+	get_mesh_neighborhood(lod_index, block_pos, blocks);
+
+	BlockType type = get_block_type(block);
+	if (type == BLOCK_EMPTY || (type == BLOCK_SOLID && is_solid_block_occluded(**lod.map, block))) {
+		if (type == BLOCK_EMPTY) {
+			block->connectivity = VoxelConnectivity::ALL;
+		}
+		else {
+			block->connectivity = VoxelConnectivity::is_opaque(**_mesher->get_library(), block->get_uniform_voxel()) ? 0 : VoxelConnectivity::ALL;
+		}
+		// Nothing to render, but the block may have been dug out
+		set_block_mesh(block, lod_index, NULL);
+		forget_block_slabs(lod_index, block_pos);
+		return;
+	}
+
+	VoxelMeshTask * task = memnew(VoxelMeshTask);
+	task->block_pos = block_pos;
+	task->lod = lod_index;
+	task->priority = get_block_priority(block_pos, lod_index);
+	task->default_voxel = lod.map->get_default_voxel(0);
+	task->mesher = _mesher;
+	task->scratches = &_mesh_scratches;
+	task->dirty_slabs = dirty_slabs;
+	const Vector<VoxelMesher::Output> * slabs = lod.slab_cache.getptr(block_pos);
+	if (slabs || dirty_slabs != VoxelMesher::ALL_SLABS) {
+		// The block is being edited. The first time, all its slabs are built.
+		task->use_slabs = true;
+		if (slabs) {
+			task->slabs = *slabs;
+		}
+	}
+	else if (_mesh_cache_enabled && _render_mode == RENDER_MESH_INSTANCE) {
+		task->mesh_cache = &_mesh_cache;
+		task->settings_hash = _mesher->get_settings_hash();
+	}
+	for (unsigned int i = 0; i < 27; ++i) {
+		task->blocks[i] = blocks[i];
+	}
+
+	lod.pending_mesh_tasks.set(block_pos, task);
+	_mesh_pool->push(task);
+}
+
+void VoxelTerrain::cache_block_slabs(int lod_index, Vector3i block_pos, const Vector<VoxelMesher::Output> & slabs) {
+	Lod & lod = _lods[lod_index];
+
+	lod.slab_cache_order.erase(block_pos);
+	lod.slab_cache_order.push_back(block_pos);
+	lod.slab_cache.set(block_pos, slabs);
+
+	if (lod.slab_cache_order.size() > MAX_SLAB_CACHE_BLOCKS) {
+		lod.slab_cache.erase(lod.slab_cache_order[0]);
+		lod.slab_cache_order.remove(0);
+	}
+}
+
+void VoxelTerrain::forget_block_slabs(int lod_index, Vector3i block_pos) {
+	Lod & lod = _lods[lod_index];
+	if (lod.slab_cache.erase(block_pos)) {
+		lod.slab_cache_order.erase(block_pos);
+	}
+}
+
+void VoxelTerrain::apply_mesh_updates() {
+	if (_mesh_pool == NULL) {
+		return;
+	}
+
+	_scheduler.begin_stage(VoxelFrameScheduler::STAGE_UPLOAD);
+
+	// Results we didn't have time for last frame come first
+	int previous_count = _completed_mesh_tasks.size();
+	_mesh_pool->pop_completed(_completed_mesh_tasks);
+
+	// Superseded tasks took time too
+	for (int j = previous_count; j < _completed_mesh_tasks.size(); ++j) {
+		const VoxelMeshTask * task = static_cast<const VoxelMeshTask*>(_completed_mesh_tasks[j]);
+		_stats.gather_time.add(task->gather_time);
+		_stats.mesh_time.add(task->mesh_time);
+	}
+
+	int i = 0;
+	while (i < _completed_mesh_tasks.size()) {
+		VoxelMeshTask * task = static_cast<VoxelMeshTask*>(_completed_mesh_tasks[i]);
+		++i;
+		Vector3i block_pos = task->block_pos;
+		int lod_index = task->lod;
+		Lod & lod = _lods[lod_index];
+
+		VoxelMeshTask ** current_task = lod.pending_mesh_tasks.getptr(block_pos);
+		if (current_task == NULL || *current_task != task) {
+			// Superseded by a newer request
+			memdelete(task);
+			continue;
+		}
+		lod.pending_mesh_tasks.erase(block_pos);
+
+		VoxelBlock * block = lod.map->get_block(block_pos);
+		if (block == NULL) {
+			memdelete(task);
+			continue;
+		}
+
+		Ref<VoxelBuffer> current_blocks[27];
+		get_mesh_neighborhood(lod_index, block_pos, current_blocks);
+		// A shared mesh can't be shown if the render mode changed meanwhile
+		if (task->is_outdated(current_blocks) || (task->cache_hit && _render_mode != RENDER_MESH_INSTANCE)) {
+			// Voxels changed while the mesh was being built
+			make_block_slabs_dirty(block_pos, lod_index, task->dirty_slabs);
+			memdelete(task);
+			update_block_mesh(block_pos, lod_index);
+			continue;
+		}
+
+		// Only the mesh and what displays it are created on the main thread
+		block->connectivity = task->connectivity;
+		uint64_t time_before = OS::get_singleton()->get_ticks_usec();
+		int vertex_count;
+		if (task->cache_hit) {
+			set_block_shared_mesh(block, lod_index, task->cached);
+			vertex_count = task->cached.vertex_count;
+			_stats.mesh_cache_hits.add(1);
+		}
+		else {
+			Ref<Mesh> mesh = set_block_mesh(block, lod_index, &task->output);
+			vertex_count = task->output.get_vertex_count();
+			if (task->use_slabs) {
+				cache_block_slabs(lod_index, block_pos, task->slabs);
+			}
+			if (task->mesh_cache) {
+				_stats.mesh_cache_misses.add(1);
+				if (mesh.is_valid()) {
+					VoxelMeshCache::Entry entry;
+					entry.check = task->cache_check;
+					entry.mesh = mesh;
+					entry.memory = block->mesh_memory;
+					entry.vertex_count = vertex_count;
+					_mesh_cache.set(task->cache_hash, entry);
+				}
+			}
+		}
+		_stats.commit_time.add(OS::get_singleton()->get_ticks_usec() - time_before);
+		_stats.blocks_meshed.add(1);
+		_stats.vertices.add(vertex_count);
+		memdelete(task);
+
+		if (_scheduler.is_over_budget()) {
+			break;
+		}
+	}
+
+	// Keep the rest for next frame
+	int remaining = _completed_mesh_tasks.size() - i;
+	for (int j = 0; j < remaining; ++j) {
+		_completed_mesh_tasks[j] = _completed_mesh_tasks[i + j];
+	}
+	_completed_mesh_tasks.resize(remaining);
+
+	_scheduler.end_stage();
+}
+
+void VoxelTerrain::set_render_mode(RenderMode mode) {
+	ERR_FAIL_INDEX(mode, RENDER_MODE_COUNT);
+	if (mode == _render_mode) {
+		return;
+	}
+
+	// Meshes are built again in the new mode
+	for (int i = 0; i < MAX_LOD; ++i) {
+		DestroyBlockMeshAction action;
+		action.terrain = this;
+		action.lod = i;
+		_lods[i].map->for_all_blocks(action);
 	}
-};
+	_render_mode = mode;
 
-void VoxelTerrain::set_provider(Ref<VoxelProvider> provider) {
-	_provider = provider;
+	if (_render_mode != RENDER_VISUAL_SERVER) {
+		free_rid_pool();
+	}
+	else {
+		// Meshes can't be shared in that mode
+		_mesh_cache.clear();
+	}
 }
 
-Ref<VoxelProvider> VoxelTerrain::get_provider() {
-	return _provider;
+RID VoxelTerrain::get_scenario() const {
+	Viewport * viewport = get_viewport();
+	if (viewport == NULL) {
+		return RID();
+	}
+	Ref<World> world = viewport->find_world();
+	return world.is_valid() ? world->get_scenario() : RID();
 }
 
-void VoxelTerrain::force_load_blocks(Vector3i center, Vector3i extents) {
-	//Vector3i min = center - extents;
-	//Vector3i max = center + extents + Vector3i(1,1,1);
-	//Vector3i size = max - min;
+void VoxelTerrain::set_blocks_scenario(RID scenario) {
+	SetBlockScenarioAction action;
+	action.scenario = scenario;
+	for (int i = 0; i < MAX_LOD; ++i) {
+		_lods[i].map->for_all_blocks(action);
+	}
+}
+
+// Shows the mesh built by a task, or hides the block if output is NULL.
+// Returns the mesh in RENDER_MESH_INSTANCE mode, so that other blocks can share it.
+Ref<Mesh> VoxelTerrain::set_block_mesh(VoxelBlock * block, int lod, const VoxelMesher::Output * output) {
+
+	// Blocks of lower detail cover a larger area with the same number of voxels
+	const int scale = 1 << lod;
+
+	if (lod == 0) {
+		// Connectivity may have changed
+		_occlusion_dirty = true;
+	}
+
+	block->mesh_memory = output ? output->get_memory_usage() : 0;
+
+	if (_render_mode == RENDER_VISUAL_SERVER) {
+
+		if (output == NULL) {
+			release_block_rids(block);
+			return Ref<Mesh>();
+		}
 
-	_block_update_queue.clear();
+		if (!block->instance_rid.is_valid()) {
+			VisualServer & vs = *VisualServer::get_singleton();
 
-	Vector3i pos;
-	for (pos.z = -extents.z; pos.z <= extents.z; ++pos.z) {
-		for (pos.x = -extents.x; pos.x <= extents.x; ++pos.x) {
-			for (pos.y = -extents.y; pos.y <= extents.y; ++pos.y) {
-				_block_update_queue.push_back(pos);
+			if (_rid_pool.empty()) {
+				block->mesh_rid = vs.mesh_create();
+				block->instance_rid = vs.instance_create();
+				vs.instance_set_base(block->instance_rid, block->mesh_rid);
+			}
+			else {
+				const BlockRids & rids = _rid_pool[_rid_pool.size() - 1];
+				block->mesh_rid = rids.mesh;
+				block->instance_rid = rids.instance;
+				_rid_pool.resize(_rid_pool.size() - 1);
 			}
+
+			Transform transform;
+			transform.basis.scale(Vector3(scale, scale, scale));
+			transform.origin = (VoxelMap::block_to_voxel(block->pos) * scale).to_vec3();
+			vs.instance_set_transform(block->instance_rid, transform);
+			vs.instance_set_scenario(block->instance_rid, get_scenario());
+			vs.instance_geometry_set_flag(block->instance_rid, VS::INSTANCE_FLAG_VISIBLE, !block->occluded);
 		}
+
+		_mesher->commit(*output, block->mesh_rid);
+		return Ref<Mesh>();
 	}
 
-	_block_update_queue.sort_custom<BlockUpdateComparator0>();
+	Ref<Mesh> mesh;
+	if (output) {
+		mesh = _mesher->commit(*output);
+	}
+	set_block_mesh_instance(block, lod, mesh);
+	return mesh;
+}
 
+// Shows a mesh from the cache, in RENDER_MESH_INSTANCE mode
+void VoxelTerrain::set_block_shared_mesh(VoxelBlock * block, int lod, const VoxelMeshCache::Entry & entry) {
+	if (lod == 0) {
+		_occlusion_dirty = true;
+	}
+	block->mesh_memory = entry.memory;
+	set_block_mesh_instance(block, lod, entry.mesh);
 }
 
-int VoxelTerrain::get_block_update_count() {
-	return _block_update_queue.size();
+void VoxelTerrain::set_block_mesh_instance(VoxelBlock * block, int lod, Ref<Mesh> mesh) {
+
+	const int scale = 1 << lod;
+
+	MeshInstance * mesh_instance = block->get_mesh_instance(*this);
+	if (mesh_instance == NULL) {
+		if (mesh.is_null()) {
+			return;
+		}
+		// Create and spawn mesh
+		mesh_instance = memnew(MeshInstance);
+		mesh_instance->set_mesh(mesh);
+		mesh_instance->set_translation((VoxelMap::block_to_voxel(block->pos) * scale).to_vec3());
+		if (scale != 1) {
+			mesh_instance->set_scale(Vector3(scale, scale, scale));
+		}
+		if (block->occluded) {
+			mesh_instance->hide();
+		}
+		add_child(mesh_instance);
+		block->mesh_instance_path = mesh_instance->get_path();
+	}
+	else {
+		// Update mesh
+		mesh_instance->set_mesh(mesh);
+	}
 }
 
-void VoxelTerrain::_notification(int p_what) {
+// Called before a block is removed
+void VoxelTerrain::destroy_block_mesh(VoxelBlock * block) {
 
-	switch (p_what) {
+	block->mesh_memory = 0;
 
-	case NOTIFICATION_ENTER_TREE:
-		set_process(true);
-		break;
+	release_block_rids(block);
 
-	case NOTIFICATION_PROCESS:
-		_process();
-		break;
+	MeshInstance * mesh_instance = block->get_mesh_instance(*this);
+	if (mesh_instance) {
+		mesh_instance->queue_delete();
+		block->mesh_instance_path = NodePath();
+	}
+}
 
-	case NOTIFICATION_EXIT_TREE:
-		break;
+// Puts the RIDs of the block aside, so the next block to show up can reuse them
+void VoxelTerrain::release_block_rids(VoxelBlock * block) {
+	if (!block->instance_rid.is_valid()) {
+		return;
+	}
 
-	default:
-		break;
+	VisualServer & vs = *VisualServer::get_singleton();
+
+	if (_rid_pool.size() < MAX_POOLED_RIDS) {
+		vs.instance_set_scenario(block->instance_rid, RID());
+		// Don't keep geometry of unused blocks in memory
+		for (int i = vs.mesh_get_surface_count(block->mesh_rid) - 1; i >= 0; --i) {
+			vs.mesh_remove_surface(block->mesh_rid, i);
+		}
+		BlockRids rids;
+		rids.instance = block->instance_rid;
+		rids.mesh = block->mesh_rid;
+		_rid_pool.push_back(rids);
 	}
+	else {
+		vs.free(block->instance_rid);
+		vs.free(block->mesh_rid);
+	}
+
+	block->instance_rid = RID();
+	block->mesh_rid = RID();
 }
 
-void VoxelTerrain::_process() {
-	update_blocks();
+void VoxelTerrain::free_rid_pool() {
+	VisualServer & vs = *VisualServer::get_singleton();
+	for (int i = 0; i < _rid_pool.size(); ++i) {
+		vs.free(_rid_pool[i].instance);
+		vs.free(_rid_pool[i].mesh);
+	}
+	_rid_pool.clear();
 }
 
-void VoxelTerrain::update_blocks() {
-	OS & os = *OS::get_singleton();
+void VoxelTerrain::set_mesh_cache_enabled(bool enable) {
+	_mesh_cache_enabled = enable;
+	if (!enable) {
+		_mesh_cache.clear();
+	}
+}
 
-	uint32_t time_before = os.get_ticks_msec();
-	uint32_t max_time = 1000 / 60;
+void VoxelTerrain::clear_mesh_cache() {
+	_mesh_cache.clear();
+}
 
-	while (!_block_update_queue.empty() && (os.get_ticks_msec() - time_before) < max_time) {
-		//printf("Remaining: %i\n", _block_update_queue.size());
+void VoxelTerrain::set_occlusion_culling(bool enable) {
+	if (enable == _occlusion_culling) {
+		return;
+	}
+	_occlusion_culling = enable;
+	_occlusion_dirty = true;
 
-		// TODO Move this to a thread
-		// TODO Have VoxelTerrainGenerator in C++
-		// TODO Keep track of MeshInstances!
+	if (!enable) {
+		// Show everything again
+		OcclusionVisibilityAction action;
+		action.terrain = this;
+		action.visit = 0;
+		_lods[0].map->for_all_blocks(action);
+	}
+}
 
-		// Get request
-		Vector3i block_pos = _block_update_queue[_block_update_queue.size() - 1];
+void VoxelTerrain::set_block_occluded(VoxelBlock * block, bool occluded) {
+	if (block->occluded == occluded) {
+		return;
+	}
+	block->occluded = occluded;
 
-		if (!_map->has_block(block_pos)) {
-			// Create buffer
-			if(!_provider.is_null()) {
-				Ref<VoxelBuffer> buffer_ref = Ref<VoxelBuffer>(memnew(VoxelBuffer));
-				const Vector3i block_size(VoxelBlock::SIZE, VoxelBlock::SIZE, VoxelBlock::SIZE);
-				buffer_ref->create(block_size.x, block_size.y, block_size.z);
+	if (block->instance_rid.is_valid()) {
+		VisualServer::get_singleton()->instance_geometry_set_flag(block->instance_rid, VS::INSTANCE_FLAG_VISIBLE, !occluded);
+	}
 
-				// Query voxel provider
-				_provider->emerge_block(buffer_ref, block_pos);
+	MeshInstance * mesh_instance = block->get_mesh_instance(*this);
+	if (mesh_instance) {
+		if (occluded) {
+			mesh_instance->hide();
+		}
+		else {
+			mesh_instance->show();
+		}
+	}
+}
 
-				// Check script return
-				ERR_FAIL_COND(buffer_ref->get_size() != block_size);
+// Hides blocks of level 0 the camera can't see through other blocks.
+// Starting from the block containing the camera, the search goes from a block to the next through a face
+// only if the face it came in from can see that one, and never back towards the camera.
+// It runs again when the camera changes block or when blocks get remeshed.
+void VoxelTerrain::update_occlusion_culling() {
+	if (!_occlusion_culling) {
+		return;
+	}
 
-				// Store buffer
-				_map->set_block_buffer(block_pos, buffer_ref);
-			}
+	const Viewer * camera = NULL;
+	for (int i = 0; i < _viewers.size(); ++i) {
+		if (!_viewers[i].frustum.empty()) {
+			camera = &_viewers[i];
+			break;
 		}
+	}
 
-		// Update meshes
-		Vector3i ndir;
-		for (ndir.z = -1; ndir.z < 2; ++ndir.z) {
-			for (ndir.x = -1; ndir.x < 2; ++ndir.x) {
-				for (ndir.y = -1; ndir.y < 2; ++ndir.y) {
-					Vector3i npos = block_pos + ndir;
-					// TODO What if the map is really composed of empty blocks?
-					if (_map->is_block_surrounded(npos)) {
-						update_block_mesh(npos);
-					}
+	VoxelMap & map = **_lods[0].map;
+	VoxelBlock * start = camera ? map.get_block(camera->block_pos) : NULL;
+
+	++_occlusion_frames;
+	const bool camera_moved = start
+		? !(_occlusion_camera_block_valid && camera->block_pos == _occlusion_camera_block)
+		: _occlusion_camera_block_valid;
+	if (!camera_moved && (!_occlusion_dirty || _occlusion_frames < OCCLUSION_DIRTY_INTERVAL)) {
+		return;
+	}
+
+	if (start) {
+		_occlusion_camera_block = camera->block_pos;
+	}
+	_occlusion_camera_block_valid = start != NULL;
+	_occlusion_dirty = false;
+	_occlusion_frames = 0;
+
+	// Without a starting point, everything is shown
+	uint32_t visit = 0;
+
+	if (start) {
+		if (++_occlusion_visit == 0) {
+			++_occlusion_visit;
+		}
+		visit = _occlusion_visit;
+
+		struct Step {
+			VoxelBlock * block;
+			int from_side; // -1 for the camera block, which can be left through any face
+			uint8_t directions; // Sides the search went through so far
+		};
+
+		Vector<Step> queue;
+		Step first;
+		first.block = start;
+		first.from_side = -1;
+		first.directions = 0;
+		start->occlusion_visit = visit;
+		queue.push_back(first);
+
+		for (int i = 0; i < queue.size(); ++i) {
+			const Step step = queue[i];
+
+			for (unsigned int side = 0; side < Voxel::SIDE_COUNT; ++side) {
+				if (step.directions & (1 << Voxel::opposite(side))) {
+					continue;
+				}
+				if (step.from_side >= 0 && !VoxelConnectivity::are_connected(step.block->connectivity, step.from_side, side)) {
+					continue;
+				}
+
+				VoxelBlock * nblock = map.get_block(step.block->pos + g_side_directions[side]);
+				if (nblock == NULL || nblock->occlusion_visit == visit) {
+					continue;
 				}
+				nblock->occlusion_visit = visit;
+
+				Step next;
+				next.block = nblock;
+				next.from_side = Voxel::opposite(side);
+				next.directions = step.directions | (1 << side);
+				queue.push_back(next);
 			}
 		}
-		//update_block_mesh(block_pos);
+	}
 
-		// Pop request
-		_block_update_queue.resize(_block_update_queue.size() - 1);
+	OcclusionVisibilityAction action;
+	action.terrain = this;
+	action.visit = visit;
+	map.for_all_blocks(action);
+}
+
+void VoxelTerrain::add_collision_body(Node * body) {
+	ERR_FAIL_NULL(body);
+	ERR_FAIL_COND(body->cast_to<Spatial>() == NULL);
+
+	uint32_t id = body->get_instance_ID();
+	for (int i = 0; i < _collision_bodies.size(); ++i) {
+		if (_collision_bodies[i].instance_id == id) {
+			return;
+		}
 	}
+
+	CollisionBody b;
+	b.instance_id = id;
+	_collision_bodies.push_back(b);
 }
 
-void VoxelTerrain::update_block_mesh(Vector3i block_pos) {
-	VoxelBlock * block = _map->get_block(block_pos);
-	if (block == NULL) {
+void VoxelTerrain::remove_collision_body(Node * body) {
+	ERR_FAIL_NULL(body);
+
+	uint32_t id = body->get_instance_ID();
+	for (int i = 0; i < _collision_bodies.size(); ++i) {
+		if (_collision_bodies[i].instance_id == id) {
+			set_collision_box(i, Rect3i());
+			_collision_bodies.remove(i);
+			return;
+		}
+	}
+}
+
+void VoxelTerrain::set_prefetch_time(float seconds) {
+	ERR_FAIL_COND(seconds < 0);
+	_prefetch_time = seconds;
+}
+
+void VoxelTerrain::set_collision_radius(int blocks) {
+	ERR_FAIL_COND(blocks < 0);
+	// Boxes are updated next frame
+	_collision_radius = blocks;
+}
+
+struct VoxelTerrain::RefCollisionAction {
+	VoxelTerrain * terrain;
+	_FORCE_INLINE_ void operator()(Vector3i block_pos) { terrain->ref_block_collision(block_pos); }
+};
+
+struct VoxelTerrain::UnrefCollisionAction {
+	VoxelTerrain * terrain;
+	_FORCE_INLINE_ void operator()(Vector3i block_pos) { terrain->unref_block_collision(block_pos); }
+};
+
+void VoxelTerrain::set_collision_box(int body_index, const Rect3i & box) {
+	CollisionBody & body = _collision_bodies[body_index];
+	if (body.box == box) {
+		return;
+	}
+
+	UnrefCollisionAction unref_action;
+	unref_action.terrain = this;
+	Rect3i::difference(body.box, box, unref_action);
+
+	RefCollisionAction ref_action;
+	ref_action.terrain = this;
+	Rect3i::difference(box, body.box, ref_action);
+
+	body.box = box;
+}
+
+void VoxelTerrain::ref_block_collision(Vector3i block_pos) {
+	int * refcount = _collision_refcounts.getptr(block_pos);
+	if (refcount) {
+		++(*refcount);
 		return;
 	}
-	if (block->voxels->is_uniform(0) && block->voxels->get_voxel(0, 0, 0, 0) == 0) {
+	_collision_refcounts.set(block_pos, 1);
+	make_block_collision_dirty(block_pos);
+}
+
+void VoxelTerrain::unref_block_collision(Vector3i block_pos) {
+	int * refcount = _collision_refcounts.getptr(block_pos);
+	ERR_FAIL_COND(refcount == NULL);
+	--(*refcount);
+	if (*refcount > 0) {
 		return;
 	}
+	_collision_refcounts.erase(block_pos);
+	_collision_dirty_blocks.erase(block_pos);
 
-	// Create buffer padded with neighbor voxels
-	VoxelBuffer nbuffer;
-	nbuffer.create(VoxelBlock::SIZE + 2, VoxelBlock::SIZE + 2, VoxelBlock::SIZE + 2);
-	_map->get_buffer_copy(VoxelMap::block_to_voxel(block_pos) - Vector3i(1, 1, 1), nbuffer);
+	VoxelCollisionTask ** pending_task = _pending_collision_tasks.getptr(block_pos);
+	if (pending_task) {
+		(*pending_task)->cancelled = true;
+		_pending_collision_tasks.erase(block_pos);
+	}
 
-	// TEST
-	//if (block_pos == Vector3i(0, 0, 0)) {
-	//    printf(">>>\n");
-	//    String os;
-	//    for (unsigned int y = 0; y < nbuffer.get_size().y; ++y) {
-	//        for (unsigned int z = 0; z < nbuffer.get_size().z; ++z) {
-	//            for (unsigned int x = 0; x < nbuffer.get_size().x; ++x) {
-	//                if (nbuffer.get_voxel(x, y, z) == 0)
-	//                    os += '-';
-	//                else
-	//                    os += 'O';
-	//            }
-	//            os += '\n';
-	//        }
-	//        os += '\n';
-	//    }
-	//    wprintf(os.c_str());
-	//}
+	VoxelBlock * block = _lods[0].map->get_block(block_pos);
+	if (block) {
+		destroy_block_collision(block);
+	}
+}
 
-	// Build mesh (that part is the most CPU-intensive)
-	Ref<Mesh> mesh = _mesher->build(nbuffer, 0);
+// Schedules the shapes of the block to be built again, if a body is close enough to need them
+void VoxelTerrain::make_block_collision_dirty(Vector3i block_pos) {
+	if (_collision_refcounts.has(block_pos)) {
+		_collision_dirty_blocks.push(block_pos, get_block_priority(block_pos));
+	}
+}
 
-	MeshInstance * mesh_instance = block->get_mesh_instance(*this);
-	if (mesh_instance == NULL) {
-		// Create and spawn mesh
-		mesh_instance = memnew(MeshInstance);
-		mesh_instance->set_mesh(mesh);
-		mesh_instance->set_translation(VoxelMap::block_to_voxel(block_pos).to_vec3());
-		add_child(mesh_instance);
-		block->mesh_instance_path = mesh_instance->get_path();
+void VoxelTerrain::update_collisions() {
+	if (_collision_pool == NULL) {
+		return;
+	}
+
+	// Follow bodies
+	for (int i = 0; i < _collision_bodies.size(); ++i) {
+		Object * obj = ObjectDB::get_instance(_collision_bodies[i].instance_id);
+		Spatial * spatial = obj ? obj->cast_to<Spatial>() : NULL;
+		if (spatial == NULL) {
+			// The body was deleted
+			set_collision_box(i, Rect3i());
+			_collision_bodies.remove(i);
+			--i;
+			continue;
+		}
+		Vector3i block_pos = VoxelMap::voxel_to_block(Vector3i(spatial->get_global_transform().origin));
+		set_collision_box(i, Rect3i::from_center_extents(block_pos, Vector3i(_collision_radius, _collision_radius, _collision_radius)));
+	}
+
+	_scheduler.begin_stage(VoxelFrameScheduler::STAGE_COLLISION);
+
+	// Closest blocks first
+	while (!_collision_dirty_blocks.empty()) {
+		Vector3i block_pos = _collision_dirty_blocks.top();
+		_collision_dirty_blocks.pop();
+
+		VoxelBlock * block = _lods[0].map->get_block(block_pos);
+		if (block == NULL) {
+			// Scheduled again once loaded
+			continue;
+		}
+
+		VoxelCollisionTask ** existing_task = _pending_collision_tasks.getptr(block_pos);
+		if (existing_task) {
+			(*existing_task)->cancelled = true;
+		}
+
+		VoxelCollisionTask * task = memnew(VoxelCollisionTask);
+		task->block_pos = block_pos;
+		task->priority = get_block_priority(block_pos);
+		task->voxels = block->voxels;
+		task->library = _mesher->get_library();
+		_pending_collision_tasks.set(block_pos, task);
+		_collision_pool->push(task);
+
+		if (_scheduler.is_over_budget()) {
+			break;
+		}
+	}
+
+	// Results we didn't have time for last frame come first
+	_collision_pool->pop_completed(_completed_collision_tasks);
+
+	int i = 0;
+	while (i < _completed_collision_tasks.size() && !_scheduler.is_over_budget()) {
+		VoxelCollisionTask * task = static_cast<VoxelCollisionTask*>(_completed_collision_tasks[i]);
+		++i;
+
+		VoxelCollisionTask ** current_task = _pending_collision_tasks.getptr(task->block_pos);
+		if (current_task && *current_task == task) {
+			_pending_collision_tasks.erase(task->block_pos);
+
+			VoxelBlock * block = _lods[0].map->get_block(task->block_pos);
+			// Modified voxels are copied before being written, so a different buffer means the shapes are outdated
+			if (block && block->voxels == task->voxels) {
+				set_block_collision(block, task->boxes);
+			}
+			else if (block) {
+				make_block_collision_dirty(task->block_pos);
+			}
+		}
+
+		memdelete(task);
+	}
+
+	// Keep the rest for next frame
+	int remaining = _completed_collision_tasks.size() - i;
+	for (int j = 0; j < remaining; ++j) {
+		_completed_collision_tasks[j] = _completed_collision_tasks[i + j];
+	}
+	_completed_collision_tasks.resize(remaining);
+
+	_scheduler.end_stage();
+}
+
+void VoxelTerrain::set_block_collision(VoxelBlock * block, const Vector<Rect3i> & boxes) {
+	PhysicsServer & ps = *PhysicsServer::get_singleton();
+
+	if (boxes.empty()) {
+		destroy_block_collision(block);
+		return;
+	}
+
+	if (!block->collision_body.is_valid()) {
+		block->collision_body = ps.body_create(PhysicsServer::BODY_MODE_STATIC);
+		// Collisions with the terrain report it as the collider
+		ps.body_attach_object_instance_ID(block->collision_body, get_instance_ID());
+		Transform transform;
+		transform.origin = VoxelMap::block_to_voxel(block->pos).to_vec3();
+		ps.body_set_state(block->collision_body, PhysicsServer::BODY_STATE_TRANSFORM, transform);
+		ps.body_set_space(block->collision_body, get_space());
 	}
 	else {
-		// Update mesh
-		mesh_instance->set_mesh(mesh);
+		ps.body_clear_shapes(block->collision_body);
+	}
+
+	for (int i = 0; i < boxes.size(); ++i) {
+		const Rect3i & box = boxes[i];
+		Transform transform;
+		transform.origin = box.pos.to_vec3() + box.size.to_vec3() * 0.5f;
+		ps.body_add_shape(block->collision_body, get_box_shape(box.size), transform);
+	}
+}
+
+void VoxelTerrain::destroy_block_collision(VoxelBlock * block) {
+	if (block->collision_body.is_valid()) {
+		PhysicsServer::get_singleton()->free(block->collision_body);
+		block->collision_body = RID();
+	}
+}
+
+// Boxes of the same size are shared by all blocks
+RID VoxelTerrain::get_box_shape(Vector3i size) {
+	RID * existing = _box_shapes.getptr(size);
+	if (existing) {
+		return *existing;
+	}
+	PhysicsServer & ps = *PhysicsServer::get_singleton();
+	RID shape = ps.shape_create(PhysicsServer::SHAPE_BOX);
+	ps.shape_set_data(shape, size.to_vec3() * 0.5f);
+	_box_shapes.set(size, shape);
+	return shape;
+}
+
+void VoxelTerrain::free_box_shapes() {
+	PhysicsServer & ps = *PhysicsServer::get_singleton();
+	const Vector3i * key = NULL;
+	while ((key = _box_shapes.next(key))) {
+		ps.free(_box_shapes.get(*key));
+	}
+	_box_shapes.clear();
+}
+
+RID VoxelTerrain::get_space() const {
+	Viewport * viewport = get_viewport();
+	if (viewport == NULL) {
+		return RID();
+	}
+	Ref<World> world = viewport->find_world();
+	return world.is_valid() ? world->get_space() : RID();
+}
+
+void VoxelTerrain::set_blocks_space(RID space) {
+	SetBlockSpaceAction action;
+	action.space = space;
+	_lods[0].map->for_all_blocks(action);
+}
+
+void VoxelTerrain::Stats::end_frame() {
+	frame_time.end_frame();
+	emerge_time.end_frame();
+	gather_time.end_frame();
+	mesh_time.end_frame();
+	commit_time.end_frame();
+	blocks_loaded.end_frame();
+	blocks_meshed.end_frame();
+	vertices.end_frame();
+	mesh_cache_hits.end_frame();
+	mesh_cache_misses.end_frame();
+}
+
+struct VoxelTerrain::MemoryStatsAction {
+	int voxels;
+	int meshes;
+	int blocks;
+	int meshed_blocks;
+	int collision_bodies;
+	void operator()(VoxelBlock * block) {
+		voxels += block->voxels->get_memory_usage();
+		meshes += block->mesh_memory;
+		++blocks;
+		if (block->mesh_memory != 0) {
+			++meshed_blocks;
+		}
+		if (block->collision_body.is_valid()) {
+			++collision_bodies;
+		}
+	}
+};
+
+// Times are averages per frame in microseconds, over the last VoxelStatWindow::SIZE frames.
+// Times of worker threads add up, so they can be larger than a frame.
+Dictionary VoxelTerrain::get_statistics() {
+	Dictionary d;
+
+	d["frame_time_usec"] = _stats.frame_time.get_average_per_frame();
+	d["emerge_time_usec"] = _stats.emerge_time.get_average_per_frame();
+	d["gather_time_usec"] = _stats.gather_time.get_average_per_frame();
+	d["mesh_time_usec"] = _stats.mesh_time.get_average_per_frame();
+	d["commit_time_usec"] = _stats.commit_time.get_average_per_frame();
+
+	for (int i = 0; i < VoxelFrameScheduler::STAGE_COUNT; ++i) {
+		static const char * names[VoxelFrameScheduler::STAGE_COUNT] = {
+			"generation_stage_usec",
+			"meshing_stage_usec",
+			"upload_stage_usec",
+			"collision_stage_usec"
+		};
+		d[names[i]] = _scheduler.get_stage_time_usec((VoxelFrameScheduler::Stage)i);
+	}
+
+	int load_queue = 0;
+	int unload_queue = 0;
+	int dirty_queue = 0;
+	int mesh_queue = 0;
+	for (int i = 0; i < MAX_LOD; ++i) {
+		const Lod & lod = _lods[i];
+		load_queue += lod.load_queue.size() + lod.pending_emerge_tasks.size();
+		unload_queue += lod.unload_queue.size();
+		dirty_queue += lod.dirty_blocks.size();
+		mesh_queue += lod.pending_mesh_tasks.size();
 	}
+	d["load_queue"] = load_queue;
+	d["unload_queue"] = unload_queue;
+	d["dirty_queue"] = dirty_queue;
+	d["mesh_queue"] = mesh_queue;
+	d["upload_queue"] = _completed_mesh_tasks.size();
+	d["save_queue"] = _save_pool ? _save_pool->get_pending_count() : 0;
+	d["collision_queue"] = _pending_collision_tasks.size() + _collision_dirty_blocks.size();
+
+	const float window_seconds = _stats.frame_time.get_sum() / 1000000.f;
+	d["blocks_loaded_per_second"] = window_seconds > 0 ? _stats.blocks_loaded.get_sum() / window_seconds : 0.f;
+	d["blocks_meshed_per_second"] = window_seconds > 0 ? _stats.blocks_meshed.get_sum() / window_seconds : 0.f;
+
+	int64_t meshed = _stats.blocks_meshed.get_sum();
+	d["average_vertices_per_block"] = meshed > 0 ? float(_stats.vertices.get_sum()) / float(meshed) : 0.f;
+
+	const int64_t cache_lookups = _stats.mesh_cache_hits.get_sum() + _stats.mesh_cache_misses.get_sum();
+	d["mesh_cache_hit_rate"] = cache_lookups > 0 ? float(_stats.mesh_cache_hits.get_sum()) / float(cache_lookups) : 0.f;
+	d["mesh_cache_size"] = _mesh_cache.get_size();
+
+	// Share of the time worker threads spent building meshes
+	float worker_utilization = 0;
+	if (_mesh_pool && _stats.frame_time.get_sum() > 0) {
+		int64_t busy = _stats.gather_time.get_sum() + _stats.mesh_time.get_sum();
+		worker_utilization = float(busy) / float(_stats.frame_time.get_sum() * _mesh_pool->get_thread_count());
+	}
+	d["worker_utilization"] = MIN(worker_utilization, 1.f);
+
+	MemoryStatsAction memory;
+	memory.voxels = 0;
+	memory.meshes = 0;
+	memory.blocks = 0;
+	memory.meshed_blocks = 0;
+	memory.collision_bodies = 0;
+	for (int i = 0; i < MAX_LOD; ++i) {
+		_lods[i].map->for_all_blocks(memory);
+	}
+	d["voxel_memory"] = memory.voxels;
+	d["mesh_memory"] = memory.meshes;
+	d["blocks"] = memory.blocks;
+	d["meshed_blocks"] = memory.meshed_blocks;
+	d["collision_bodies"] = memory.collision_bodies;
+	d["collision_shapes"] = _box_shapes.size();
+	d["pooled_rids"] = _rid_pool.size();
+
+	return d;
 }
 
-//void VoxelTerrain::block_removed(VoxelBlock & block) {
-//    MeshInstance * mesh_instance = block.get_mesh_instance(*this);
-//    if (mesh_instance) {
-//        mesh_instance->queue_delete();
-//    }
-//}
+void VoxelTerrain::set_stage_budget_usec(int stage, int usec) {
+	ERR_FAIL_INDEX(stage, VoxelFrameScheduler::STAGE_COUNT);
+	_scheduler.set_budget_usec((VoxelFrameScheduler::Stage)stage, usec);
+}
+
+int VoxelTerrain::get_stage_budget_usec(int stage) const {
+	ERR_FAIL_INDEX_V(stage, VoxelFrameScheduler::STAGE_COUNT, 0);
+	return _scheduler.get_budget_usec((VoxelFrameScheduler::Stage)stage);
+}
+
+int VoxelTerrain::get_current_stage_budget_usec(int stage) const {
+	ERR_FAIL_INDEX_V(stage, VoxelFrameScheduler::STAGE_COUNT, 0);
+	return _scheduler.get_current_budget_usec((VoxelFrameScheduler::Stage)stage);
+}
 
 void VoxelTerrain::_bind_methods() {
 
@@ -190,6 +2446,7 @@ void VoxelTerrain::_bind_methods() {
 	ObjectTypeDB::bind_method(_MD("get_provider:VoxelProvider"), &VoxelTerrain::get_provider);
 
 	ObjectTypeDB::bind_method(_MD("get_block_update_count"), &VoxelTerrain::get_block_update_count);
+	ObjectTypeDB::bind_method(_MD("get_statistics"), &VoxelTerrain::get_statistics);
 	ObjectTypeDB::bind_method(_MD("get_mesher:VoxelMesher"), &VoxelTerrain::get_mesher);
 
 	ObjectTypeDB::bind_method(_MD("get_map:VoxelMap"), &VoxelTerrain::get_map);
@@ -200,5 +2457,68 @@ void VoxelTerrain::_bind_methods() {
 
 	ObjectTypeDB::bind_method(_MD("force_load_blocks", "center", "extents"), &VoxelTerrain::_force_load_blocks_binding);
 
+	ObjectTypeDB::bind_method(_MD("set_render_mode", "mode"), &VoxelTerrain::set_render_mode);
+	ObjectTypeDB::bind_method(_MD("get_render_mode"), &VoxelTerrain::get_render_mode);
+
+	ObjectTypeDB::bind_method(_MD("set_occlusion_culling", "enable"), &VoxelTerrain::set_occlusion_culling);
+	ObjectTypeDB::bind_method(_MD("get_occlusion_culling"), &VoxelTerrain::get_occlusion_culling);
+
+	ObjectTypeDB::bind_method(_MD("set_mesh_cache_enabled", "enable"), &VoxelTerrain::set_mesh_cache_enabled);
+	ObjectTypeDB::bind_method(_MD("get_mesh_cache_enabled"), &VoxelTerrain::get_mesh_cache_enabled);
+	ObjectTypeDB::bind_method(_MD("clear_mesh_cache"), &VoxelTerrain::clear_mesh_cache);
+
+	ObjectTypeDB::bind_method(_MD("add_collision_body", "body:Spatial"), &VoxelTerrain::add_collision_body);
+	ObjectTypeDB::bind_method(_MD("remove_collision_body", "body:Spatial"), &VoxelTerrain::remove_collision_body);
+	ObjectTypeDB::bind_method(_MD("set_collision_radius", "blocks"), &VoxelTerrain::set_collision_radius);
+	ObjectTypeDB::bind_method(_MD("get_collision_radius"), &VoxelTerrain::get_collision_radius);
+
+	ObjectTypeDB::bind_method(_MD("set_max_y", "block_y"), &VoxelTerrain::set_max_y);
+	ObjectTypeDB::bind_method(_MD("set_min_y", "block_y"), &VoxelTerrain::set_min_y);
+	ObjectTypeDB::bind_method(_MD("get_min_y"), &VoxelTerrain::get_min_y);
+	ObjectTypeDB::bind_method(_MD("get_max_y"), &VoxelTerrain::get_max_y);
+
+	ObjectTypeDB::bind_method(_MD("set_max_unloads_per_frame", "count"), &VoxelTerrain::set_max_unloads_per_frame);
+	ObjectTypeDB::bind_method(_MD("get_max_unloads_per_frame"), &VoxelTerrain::get_max_unloads_per_frame);
+
+	ObjectTypeDB::bind_method(_MD("set_prefetch_time", "seconds"), &VoxelTerrain::set_prefetch_time);
+	ObjectTypeDB::bind_method(_MD("get_prefetch_time"), &VoxelTerrain::get_prefetch_time);
+
+	ObjectTypeDB::bind_method(_MD("set_stage_budget_usec", "stage", "usec"), &VoxelTerrain::set_stage_budget_usec);
+	ObjectTypeDB::bind_method(_MD("get_stage_budget_usec", "stage"), &VoxelTerrain::get_stage_budget_usec);
+	ObjectTypeDB::bind_method(_MD("get_current_stage_budget_usec", "stage"), &VoxelTerrain::get_current_stage_budget_usec);
+
+	ObjectTypeDB::bind_method(_MD("set_target_frame_time_usec", "usec"), &VoxelTerrain::set_target_frame_time_usec);
+	ObjectTypeDB::bind_method(_MD("get_target_frame_time_usec"), &VoxelTerrain::get_target_frame_time_usec);
+
+	ObjectTypeDB::bind_method(_MD("set_adaptive_budgets", "enable"), &VoxelTerrain::set_adaptive_budgets);
+	ObjectTypeDB::bind_method(_MD("get_adaptive_budgets"), &VoxelTerrain::get_adaptive_budgets);
+
+	ObjectTypeDB::bind_method(_MD("set_lod_count", "count"), &VoxelTerrain::set_lod_count);
+	ObjectTypeDB::bind_method(_MD("get_lod_count"), &VoxelTerrain::get_lod_count);
+
+	ObjectTypeDB::bind_method(_MD("set_lod_distance", "lod", "distance"), &VoxelTerrain::set_lod_distance);
+	ObjectTypeDB::bind_method(_MD("get_lod_distance", "lod"), &VoxelTerrain::get_lod_distance);
+
+	ObjectTypeDB::bind_method(_MD("set_lod_hysteresis", "blocks"), &VoxelTerrain::set_lod_hysteresis);
+	ObjectTypeDB::bind_method(_MD("get_lod_hysteresis"), &VoxelTerrain::get_lod_hysteresis);
+
+	ObjectTypeDB::bind_method(_MD("get_lod_map:VoxelMap", "lod"), &VoxelTerrain::get_lod_map);
+
+	ObjectTypeDB::bind_method(_MD("make_block_dirty", "block_pos"), &VoxelTerrain::_make_block_dirty_binding);
+	ObjectTypeDB::bind_method(_MD("make_voxel_dirty", "voxel_pos"), &VoxelTerrain::_make_voxel_dirty_binding);
+
+	ObjectTypeDB::bind_method(_MD("add_viewer", "viewer:Spatial"), &VoxelTerrain::add_viewer);
+	ObjectTypeDB::bind_method(_MD("remove_viewer", "viewer:Spatial"), &VoxelTerrain::remove_viewer);
+
+	ObjectTypeDB::bind_integer_constant(get_type_static(), "STAGE_GENERATION", VoxelFrameScheduler::STAGE_GENERATION);
+	ObjectTypeDB::bind_integer_constant(get_type_static(), "STAGE_MESHING", VoxelFrameScheduler::STAGE_MESHING);
+	ObjectTypeDB::bind_integer_constant(get_type_static(), "STAGE_UPLOAD", VoxelFrameScheduler::STAGE_UPLOAD);
+	ObjectTypeDB::bind_integer_constant(get_type_static(), "STAGE_COLLISION", VoxelFrameScheduler::STAGE_COLLISION);
+
+	ObjectTypeDB::bind_integer_constant(get_type_static(), "MAX_LOD", MAX_LOD);
+
+	BIND_CONSTANT(RENDER_MESH_INSTANCE);
+	BIND_CONSTANT(RENDER_VISUAL_SERVER);
+
 }
 
@@ -4,33 +4,203 @@
 #include <scene/main/node.h>
 #include "voxel_map.h"
 #include "voxel_mesher.h"
+#include "voxel_mesh_cache.h"
 #include "voxel_provider.h"
+#include "voxel_thread_pool.h"
+#include "voxel_priority_queue.h"
+#include "rect3i.h"
+#include "voxel_frame_scheduler.h"
+#include "voxel_stat_window.h"
+
+class VoxelMeshTask;
+class VoxelSaveTask;
+class VoxelEmergeTask;
+class VoxelCollisionTask;
 
 // Infinite static terrain made of voxels.
-// It is loaded around VoxelTerrainStreamers.
-class VoxelTerrain : public Node /*, public IVoxelMapObserver*/ {
+// It is loaded around VoxelTerrainStreamers, and unloaded when they go away.
+class VoxelTerrain : public Node, public IVoxelMapObserver {
 	OBJ_TYPE(VoxelTerrain, Node)
 public:
+	// Level 0 is full resolution, each next level halves it
+	static const int MAX_LOD = 4;
+
+	enum RenderMode {
+		// Each block is a MeshInstance child of the terrain
+		RENDER_MESH_INSTANCE = 0,
+		// Blocks are instances created directly in the VisualServer, which avoids the cost of nodes.
+		// They are not visible in the scene tree.
+		RENDER_VISUAL_SERVER,
+		RENDER_MODE_COUNT
+	};
+
 	VoxelTerrain();
+	~VoxelTerrain();
 
 	void set_provider(Ref<VoxelProvider> provider);
 	Ref<VoxelProvider> get_provider();
 
+	// Changing the mode rebuilds all meshes
+	void set_render_mode(RenderMode mode);
+	RenderMode get_render_mode() const { return _render_mode; }
+
+	// Hides blocks the first camera can't see because other blocks are in the way, like caves seen from the surface.
+	// Only blocks of level 0 are affected.
+	void set_occlusion_culling(bool enable);
+	bool get_occlusion_culling() const { return _occlusion_culling; }
+
+	// Blocks made of the same voxels as a recently meshed one share its mesh instead of being meshed again,
+	// which is common in generated terrain. Only used in RENDER_MESH_INSTANCE mode.
+	void set_mesh_cache_enabled(bool enable);
+	bool get_mesh_cache_enabled() const { return _mesh_cache_enabled; }
+	// Must be called after voxel types of the library are modified, the cache doesn't know about it
+	void clear_mesh_cache();
+
 	void force_load_blocks(Vector3i center, Vector3i extents);
 	int get_block_update_count();
 
+	// Times, queue sizes, throughput and memory of the terrain, averaged over the last frames where it applies.
+	// Meant to be polled by scripts to display or monitor them.
+	Dictionary get_statistics();
+
+	// Blocks closest to viewers are loaded first. Cameras also favor blocks in their view.
+	// If the viewer is a VoxelTerrainStreamer, blocks within its view distance are kept loaded.
+	void add_viewer(Node * viewer);
+	void remove_viewer(Node * viewer);
+
+	// Collision shapes are only built for loaded blocks within the collision radius of these bodies.
+	// Solid voxels are merged into boxes on a worker thread, and built again when voxels of the block change.
+	void add_collision_body(Node * body);
+	void remove_collision_body(Node * body);
+
+	void set_collision_radius(int blocks);
+	int get_collision_radius() const { return _collision_radius; }
+
+	// Streamers also load blocks where they will be after this time if they keep their velocity, 0 disables it.
+	// These blocks are loaded and meshed after those around streamers, and dropped if streamers change course.
+	void set_prefetch_time(float seconds);
+	float get_prefetch_time() const { return _prefetch_time; }
+
+	// Blocks going out of range are unloaded progressively, modified ones are sent to VoxelProvider::immerge_block.
+	// Note that immerge_block is then called from a background thread.
+	void set_max_unloads_per_frame(int count);
+	int get_max_unloads_per_frame() const { return _max_unloads_per_frame; }
+
+	// Vertical bounds of streaming, in blocks, inclusive. Blocks out of bounds are never loaded,
+	// and are considered made of the default voxel of the map when meshing their neighbors.
+	// Within bounds, blocks the provider reports as above or below the surface are created without emerging them
+	// (see VoxelProvider::get_surface_bounds).
+	void set_min_y(int block_y) { _min_y = block_y; }
+	int get_min_y() const { return _min_y; }
+
+	void set_max_y(int block_y) { _max_y = block_y; }
+	int get_max_y() const { return _max_y; }
+
+	// Time the terrain may spend per frame in each of its stages (see VoxelFrameScheduler::Stage).
+	// In adaptive mode, budgets are lowered while frames take longer than the target frame time.
+	void set_stage_budget_usec(int stage, int usec);
+	int get_stage_budget_usec(int stage) const;
+	int get_current_stage_budget_usec(int stage) const;
+
+	void set_target_frame_time_usec(int usec) { _scheduler.set_target_frame_time_usec(usec); }
+	int get_target_frame_time_usec() const { return _scheduler.get_target_frame_time_usec(); }
+
+	void set_adaptive_budgets(bool enable) { _scheduler.set_adaptive(enable); }
+	bool get_adaptive_budgets() const { return _scheduler.is_adaptive(); }
+
+	// Levels of detail are rings around the first streamer. Beyond its view distance, level 1 takes over
+	// with blocks twice as large and half the resolution, and so on for each level.
+	// Voxels of levels above 0 come from VoxelProvider::emerge_block_lod, and are not affected by edits.
+	void set_lod_count(int count);
+	int get_lod_count() const { return _lod_count; }
+
+	// Distance covered by a level, in blocks of that level. Level 0 uses the view distance of the streamer.
+	void set_lod_distance(int lod, int distance);
+	int get_lod_distance(int lod) const;
+
+	// How many blocks the streamer can move away from the center of the rings before they follow it.
+	// This prevents blocks from switching back and forth between levels when it moves around a block boundary.
+	void set_lod_hysteresis(int blocks);
+	int get_lod_hysteresis() const { return _lod_hysteresis; }
+
+	// Schedules blocks to be remeshed at the end of the frame.
+	// Voxels modified through the map are taken care of, this is for other kinds of modifications.
+	void make_block_dirty(Vector3i block_pos, int lod = 0);
+	void make_voxel_dirty(Vector3i pos);
+
 	Ref<VoxelMesher> get_mesher() { return _mesher; }
-	Ref<VoxelMap> get_map() { return _map; }
+	Ref<VoxelMap> get_map() { return _lods[0].map; }
+	Ref<VoxelMap> get_lod_map(int lod);
 
 protected:
 	void _notification(int p_what);
 	void _process();
 
 	void update_blocks();
-	void update_block_mesh(Vector3i block_pos);
+	void apply_emerged_blocks();
+	void make_blocks_around_dirty(Vector3i block_pos, int lod);
+	void update_block_mesh(Vector3i block_pos, int lod);
+	void apply_mesh_updates();
+
+	Ref<Mesh> set_block_mesh(VoxelBlock * block, int lod, const VoxelMesher::Output * output);
+	void set_block_shared_mesh(VoxelBlock * block, int lod, const VoxelMeshCache::Entry & entry);
+	void set_block_mesh_instance(VoxelBlock * block, int lod, Ref<Mesh> mesh);
+	void destroy_block_mesh(VoxelBlock * block);
+	void release_block_rids(VoxelBlock * block);
+	void free_rid_pool();
+	void set_block_occluded(VoxelBlock * block, bool occluded);
+	RID get_scenario() const;
+	void set_blocks_scenario(RID scenario);
+
+	void start_threads();
+	void stop_threads();
+
+	void update_viewers();
+	void refresh_block_priorities();
+	int get_block_priority(Vector3i block_pos, int lod = 0) const;
+
+	void set_viewer_box(int viewer_index, const Rect3i & box);
+	void set_viewer_prefetch_box(int viewer_index, const Rect3i & box);
+	void set_streaming_box(Rect3i & current_box, const Rect3i & requested_box);
+	bool is_block_prefetched_only(Vector3i block_pos) const;
+	void ref_block(Vector3i block_pos);
+	void unref_block(Vector3i block_pos);
+	void unload_blocks();
+	void unload_block(Vector3i block_pos, int lod, VoxelSaveTask ** save_task);
+	void save_modified_blocks();
+	void pop_completed_saves();
+
+	void update_lods(int main_viewer_index, int view_distance);
+	void set_lod_ring(int lod, Rect3i box, Rect3i hole);
+	void lod_ring_changed(int lod, Vector3i block_pos, bool entered);
+	bool is_in_lod_ring(int lod, Vector3i block_pos) const;
+	bool is_lod_area_rendered(int lod, Vector3i block_pos);
+
+	bool is_block_known_uniform(int lod, Vector3i block_pos) const;
+	bool get_block_surface_hint(int lod, Vector3i block_pos, int & out_voxel) const;
+	Rect3i clip_to_height(const Rect3i & box, int lod) const;
+	bool is_block_meshable(int lod, Vector3i block_pos);
+	void get_mesh_neighborhood(int lod, Vector3i block_pos, Ref<VoxelBuffer> out_blocks[27]);
+	void update_dirty_blocks();
+	void make_block_slabs_dirty(Vector3i block_pos, int lod, uint32_t slabs);
+	void cache_block_slabs(int lod, Vector3i block_pos, const Vector<VoxelMesher::Output> & slabs);
+	void forget_block_slabs(int lod, Vector3i block_pos);
+
+	void update_collisions();
+	void set_collision_box(int body_index, const Rect3i & box);
+	void ref_block_collision(Vector3i block_pos);
+	void unref_block_collision(Vector3i block_pos);
+	void make_block_collision_dirty(Vector3i block_pos);
+	void set_block_collision(VoxelBlock * block, const Vector<Rect3i> & boxes);
+	void destroy_block_collision(VoxelBlock * block);
+	RID get_box_shape(Vector3i size);
+	void free_box_shapes();
+	RID get_space() const;
+	void set_blocks_space(RID space);
+	void update_occlusion_culling();
 
 	// Observer events
-	//void block_removed(VoxelBlock & block);
+	void voxel_changed(Vector3i pos);
 
 	static void _bind_methods();
 
@@ -38,19 +208,186 @@ protected:
 	Vector3 _voxel_to_block_binding(Vector3 pos) { return Vector3i(VoxelMap::voxel_to_block(pos)).to_vec3(); }
 	Vector3 _block_to_voxel_binding(Vector3 pos) { return Vector3i(VoxelMap::block_to_voxel(pos)).to_vec3(); }
 	void _force_load_blocks_binding(Vector3 center, Vector3 extents) { force_load_blocks(center, extents); }
+	void _make_block_dirty_binding(Vector3 bpos) { make_block_dirty(Vector3i(bpos)); }
+	void _make_voxel_dirty_binding(Vector3 pos) { make_voxel_dirty(Vector3i(pos)); }
 
 private:
+	struct Viewer {
+		uint32_t instance_id;
+		Vector3 position; // In voxels
+		bool has_position; // False until the first update
+		Vector3 velocity; // Smoothed, in voxels per second
+		Vector3i block_pos;
+		Vector<Plane> frustum; // Empty if the viewer is not a Camera
+		Rect3i box; // Blocks the viewer keeps loaded, empty if it's not a streamer
+		Rect3i prefetch_box; // Blocks around where the viewer is heading, empty if it's not moving to another block
+	};
+
+	struct CollisionBody {
+		uint32_t instance_id;
+		Rect3i box; // Blocks that need collision shapes for this body
+	};
+
+	// Blocks and meshes of one level of detail, positions are in blocks of that level
+	struct Lod {
+		// Voxel storage
+		Ref<VoxelMap> map;
+
+		VoxelPriorityQueue<Vector3i, Vector3iHasher> load_queue;
+
+		// Blocks that are not wanted anymore. They may have been requested again since then.
+		Vector<Vector3i> unload_queue;
+
+		// Blocks to remesh, edits made during the same frame are merged
+		VoxelPriorityQueue<Vector3i, Vector3iHasher> dirty_blocks;
+		// Slabs to remesh (see VoxelMesher::build_slabs()) of dirty blocks that were only edited.
+		// Dirty blocks without an entry are remeshed entirely.
+		HashMap<Vector3i, uint32_t, Vector3iHasher> dirty_slabs;
+
+		// Meshes of the last edited blocks in slabs, so that further edits only rebuild the slabs they touch.
+		// Oldest first in the order, they are forgotten past MAX_SLAB_CACHE_BLOCKS.
+		HashMap<Vector3i, Vector<VoxelMesher::Output>, Vector3iHasher> slab_cache;
+		Vector<Vector3i> slab_cache_order;
+
+		// Meshing runs on worker threads, only the latest request for a given block is kept
+		HashMap<Vector3i, VoxelMeshTask*, Vector3iHasher> pending_mesh_tasks;
+		// Blocks of levels above 0 being emerged by a worker thread
+		HashMap<Vector3i, VoxelEmergeTask*, Vector3iHasher> pending_emerge_tasks;
+
+		// Blocks rendered at this level while LOD is enabled, except those in the hole,
+		// which are rendered by the previous level. Both are empty if the level is not used.
+		Rect3i box;
+		Rect3i hole;
+	};
+
+	// What a block renders regardless of its neighbors
+	enum BlockType {
+		BLOCK_EMPTY, // Nothing
+		BLOCK_SOLID, // Only faces on its boundaries, which neighbors can hide
+		BLOCK_MIXED
+	};
+
+	BlockType get_block_type(VoxelBlock * block) const;
+	bool is_solid_block_occluded(VoxelMap & map, VoxelBlock * block) const;
+
+	struct BlockRids {
+		RID instance;
+		RID mesh;
+	};
+
+	struct RefBlockAction;
+	struct UnrefBlockAction;
+	struct LodRingAction;
+	struct DestroyBlockMeshAction;
+	struct SetBlockScenarioAction;
+	struct OcclusionVisibilityAction;
+	struct RefCollisionAction;
+	struct UnrefCollisionAction;
+	struct DestroyBlockCollisionAction;
+	struct SetBlockSpaceAction;
+	struct MemoryStatsAction;
+	struct SaveModifiedBlockAction;
+
+	// Measures of the last frames, see get_statistics()
+	struct Stats {
+		VoxelStatWindow frame_time;
+		VoxelStatWindow emerge_time;
+		VoxelStatWindow gather_time; // Worker threads
+		VoxelStatWindow mesh_time; // Worker threads
+		VoxelStatWindow commit_time;
+		VoxelStatWindow blocks_loaded;
+		VoxelStatWindow blocks_meshed;
+		VoxelStatWindow vertices;
+		VoxelStatWindow mesh_cache_hits;
+		VoxelStatWindow mesh_cache_misses;
+
+		void end_frame();
+	};
+
+	// Released RIDs are kept for reuse up to this count
+	static const int MAX_POOLED_RIDS = 1024;
+	// Edited blocks whose mesh is kept in slabs, per level
+	static const int MAX_SLAB_CACHE_BLOCKS = 16;
+
 	// Parameters
 	int _min_y; // In blocks, not voxels
 	int _max_y;
+	int _max_unloads_per_frame;
+	RenderMode _render_mode;
+	int _lod_count;
+	int _lod_distances[MAX_LOD];
+	int _lod_hysteresis;
+	int _collision_radius;
+	float _prefetch_time;
+	bool _mesh_cache_enabled;
+
+	Lod _lods[MAX_LOD];
+
+	// Where rings are centered, in blocks of level 0
+	Vector3i _lod_center;
+	bool _lod_center_valid;
+
+	bool _occlusion_culling;
+	// Blocks were meshed or removed since the last search
+	bool _occlusion_dirty;
+	// Where the last search started
+	Vector3i _occlusion_camera_block;
+	bool _occlusion_camera_block_valid;
+	uint32_t _occlusion_visit;
+	// Frames since the last search
+	int _occlusion_frames;
+
+	Vector<Viewer> _viewers;
+
+	// Priorities of level 0 are refreshed a bit every frame after viewers moved.
+	// Keys are taken when they moved, because refreshing reorders the queue. Next to refresh is at the index.
+	// Other levels are few enough to rely on the check made before loading.
+	Vector<Vector3i> _priority_refresh_keys;
+	int _priority_refresh_index;
 
-	// Voxel storage
-	Ref<VoxelMap> _map;
+	// How many streamers want each block of level 0 to be loaded
+	HashMap<Vector3i, int, Vector3iHasher> _block_refcounts;
+
+	VoxelFrameScheduler _scheduler;
+	Stats _stats;
 
-	Vector<Vector3i> _block_update_queue;
 	Ref<VoxelMesher> _mesher;
 	Ref<VoxelProvider> _provider;
 
+	VoxelThreadPool * _mesh_pool;
+	// Memory each meshing thread reuses from one block to the next, indexed by VoxelTask::thread_index
+	Vector<VoxelMesher::Scratch*> _mesh_scratches;
+	// Results waiting to be uploaded
+	Vector<VoxelTask*> _completed_mesh_tasks;
+	VoxelMeshCache _mesh_cache;
+
+	// Instance and mesh RIDs of blocks that went away, in RENDER_VISUAL_SERVER mode
+	Vector<BlockRids> _rid_pool;
+
+	// Saving runs on its own thread so it doesn't wait behind meshing
+	VoxelThreadPool * _save_pool;
+	// Voxels of level 0 blocks handed to the save pool, until it's done with them.
+	// The provider would return older voxels if they were loaded again in the meantime.
+	HashMap<Vector3i, Ref<VoxelBuffer>, Vector3iHasher> _saving_blocks;
+
+	// Same for collision shapes, so bodies don't fall through blocks waiting for their meshes
+	VoxelThreadPool * _collision_pool;
+
+	// Blocks of levels above 0 can take many calls to the provider, so they are emerged on their own thread
+	VoxelThreadPool * _emerge_pool;
+	// Results waiting to be stored in maps
+	Vector<VoxelTask*> _completed_emerge_tasks;
+
+	Vector<CollisionBody> _collision_bodies;
+	// How many bodies want collision shapes for each block of level 0
+	HashMap<Vector3i, int, Vector3iHasher> _collision_refcounts;
+	VoxelPriorityQueue<Vector3i, Vector3iHasher> _collision_dirty_blocks;
+	HashMap<Vector3i, VoxelCollisionTask*, Vector3iHasher> _pending_collision_tasks;
+	// Results waiting for their shapes to be created
+	Vector<VoxelTask*> _completed_collision_tasks;
+	// Shared by all blocks, by size in voxels
+	HashMap<Vector3i, RID, Vector3iHasher> _box_shapes;
+
 };
 
 #endif // VOXEL_TERRAIN_H
@@ -0,0 +1,76 @@
+#include "voxel_terrain_streamer.h"
+#include "voxel_terrain.h"
+
+VoxelTerrainStreamer::VoxelTerrainStreamer() : Spatial(), _view_distance(8), _terrain_id(0) {
+}
+
+void VoxelTerrainStreamer::set_terrain_path(NodePath path) {
+	_terrain_path = path;
+	if (is_inside_tree()) {
+		unregister_from_terrain();
+		register_to_terrain();
+	}
+}
+
+void VoxelTerrainStreamer::set_view_distance(int distance) {
+	ERR_FAIL_COND(distance < 0);
+	// Picked up by the terrain on its next update
+	_view_distance = distance;
+}
+
+void VoxelTerrainStreamer::register_to_terrain() {
+	if (_terrain_path.is_empty()) {
+		return;
+	}
+	Node * node = get_node(_terrain_path);
+	ERR_FAIL_NULL(node);
+	VoxelTerrain * terrain = node->cast_to<VoxelTerrain>();
+	ERR_FAIL_NULL(terrain);
+
+	terrain->add_viewer(this);
+	_terrain_id = terrain->get_instance_ID();
+}
+
+void VoxelTerrainStreamer::unregister_from_terrain() {
+	if (_terrain_id == 0) {
+		return;
+	}
+	// The terrain may have been deleted before us
+	Object * obj = ObjectDB::get_instance(_terrain_id);
+	VoxelTerrain * terrain = obj ? obj->cast_to<VoxelTerrain>() : NULL;
+	if (terrain) {
+		terrain->remove_viewer(this);
+	}
+	_terrain_id = 0;
+}
+
+void VoxelTerrainStreamer::_notification(int p_what) {
+
+	switch (p_what) {
+
+	// Ready is used because the terrain may not be in the tree yet when we enter it
+	case NOTIFICATION_READY:
+		register_to_terrain();
+		break;
+
+	case NOTIFICATION_EXIT_TREE:
+		unregister_from_terrain();
+		break;
+
+	default:
+		break;
+	}
+}
+
+void VoxelTerrainStreamer::_bind_methods() {
+
+	ObjectTypeDB::bind_method(_MD("set_terrain_path", "path"), &VoxelTerrainStreamer::set_terrain_path);
+	ObjectTypeDB::bind_method(_MD("get_terrain_path"), &VoxelTerrainStreamer::get_terrain_path);
+
+	ObjectTypeDB::bind_method(_MD("set_view_distance", "distance"), &VoxelTerrainStreamer::set_view_distance);
+	ObjectTypeDB::bind_method(_MD("get_view_distance"), &VoxelTerrainStreamer::get_view_distance);
+
+	ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "terrain"), _SCS("set_terrain_path"), _SCS("get_terrain_path"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "view_distance"), _SCS("set_view_distance"), _SCS("get_view_distance"));
+
+}
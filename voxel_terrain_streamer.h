@@ -0,0 +1,39 @@
+#ifndef VOXEL_TERRAIN_STREAMER_H
+#define VOXEL_TERRAIN_STREAMER_H
+
+#include <scene/3d/spatial.h>
+
+class VoxelTerrain;
+
+// Put this on players, cameras or anything else that needs terrain around it.
+// The VoxelTerrain keeps blocks loaded within view distance of its streamers and unloads the others.
+class VoxelTerrainStreamer : public Spatial {
+	OBJ_TYPE(VoxelTerrainStreamer, Spatial)
+public:
+	VoxelTerrainStreamer();
+
+	void set_terrain_path(NodePath path);
+	NodePath get_terrain_path() const { return _terrain_path; }
+
+	// In blocks
+	void set_view_distance(int distance);
+	int get_view_distance() const { return _view_distance; }
+
+protected:
+	void _notification(int p_what);
+
+	static void _bind_methods();
+
+private:
+	void register_to_terrain();
+	void unregister_from_terrain();
+
+	NodePath _terrain_path;
+	int _view_distance;
+
+	// Instance ID of the terrain this streamer is registered to
+	uint32_t _terrain_id;
+
+};
+
+#endif // VOXEL_TERRAIN_STREAMER_H
@@ -0,0 +1,125 @@
+#include "voxel_thread_pool.h"
+#include <os/os.h>
+
+VoxelThreadPool::VoxelThreadPool(int thread_count) : _running_count(0), _quit(false) {
+
+	_mutex = Mutex::create();
+	_semaphore = Semaphore::create();
+
+	if (thread_count < 1)
+		thread_count = 1;
+
+	for (int i = 0; i < thread_count; ++i) {
+		ThreadData * data = memnew(ThreadData);
+		data->pool = this;
+		data->index = i;
+		_thread_data.push_back(data);
+		_threads.push_back(Thread::create(_thread_func, data));
+	}
+}
+
+VoxelThreadPool::~VoxelThreadPool() {
+
+	_mutex->lock();
+	_quit = true;
+	_mutex->unlock();
+
+	for (int i = 0; i < _threads.size(); ++i) {
+		_semaphore->post();
+	}
+	for (int i = 0; i < _threads.size(); ++i) {
+		Thread::wait_to_finish(_threads[i]);
+		memdelete(_threads[i]);
+		memdelete(_thread_data[i]);
+	}
+
+	for (int i = 0; i < _pending.size(); ++i) {
+		memdelete(_pending.get_key(i));
+	}
+	for (int i = 0; i < _completed.size(); ++i) {
+		memdelete(_completed[i]);
+	}
+
+	memdelete(_semaphore);
+	memdelete(_mutex);
+}
+
+void VoxelThreadPool::push(VoxelTask * task) {
+	ERR_FAIL_COND(task == NULL);
+
+	_mutex->lock();
+	_pending.push(task, task->priority);
+	_mutex->unlock();
+
+	_semaphore->post();
+}
+
+void VoxelThreadPool::pop_completed(Vector<VoxelTask*> & out_tasks) {
+
+	_mutex->lock();
+	for (int i = 0; i < _completed.size(); ++i) {
+		out_tasks.push_back(_completed[i]);
+	}
+	_completed.clear();
+	_mutex->unlock();
+}
+
+void VoxelThreadPool::flush() {
+	while (true) {
+		_mutex->lock();
+		bool done = _pending.empty() && _running_count == 0;
+		_mutex->unlock();
+		if (done) {
+			break;
+		}
+		OS::get_singleton()->delay_usec(1000);
+	}
+}
+
+int VoxelThreadPool::get_pending_count() const {
+	_mutex->lock();
+	int count = _pending.size();
+	_mutex->unlock();
+	return count;
+}
+
+void VoxelThreadPool::_thread_func(void * p_data) {
+	ThreadData * data = (ThreadData*)p_data;
+	data->pool->thread_func(data->index);
+}
+
+void VoxelThreadPool::thread_func(int thread_index) {
+
+	while (true) {
+
+		_semaphore->wait();
+
+		_mutex->lock();
+
+		if (_quit) {
+			_mutex->unlock();
+			break;
+		}
+
+		if (_pending.empty()) {
+			_mutex->unlock();
+			continue;
+		}
+
+		VoxelTask * task = _pending.top();
+		_pending.pop();
+		++_running_count;
+
+		_mutex->unlock();
+
+		if (!task->cancelled) {
+			task->thread_index = thread_index;
+			task->run();
+		}
+
+		_mutex->lock();
+		_completed.push_back(task);
+		--_running_count;
+		_mutex->unlock();
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef VOXEL_THREAD_POOL_H
+#define VOXEL_THREAD_POOL_H
+
+#include <os/thread.h>
+#include <os/mutex.h>
+#include <os/semaphore.h>
+#include <vector.h>
+#include "voxel_priority_queue.h"
+
+// Unit of work executed by a VoxelThreadPool.
+// run() is called from a worker thread, so it must not access the scene tree or servers.
+class VoxelTask {
+public:
+	VoxelTask() : priority(0), cancelled(false), thread_index(0) {}
+	virtual ~VoxelTask() {}
+
+	virtual void run() = 0;
+
+	// Pending tasks with the lowest value are run first. Changing it after push() has no effect.
+	int priority;
+
+	// Can be set from the main thread at any time.
+	// A cancelled task is not run if it didn't start yet, but is still handed back as completed.
+	volatile bool cancelled;
+
+	// Index of the worker thread running the task, set before run().
+	// Tasks can use it to pick data owned by that thread, which no other task uses at the same time.
+	int thread_index;
+};
+
+// Fixed set of worker threads consuming VoxelTasks.
+// Tasks are owned by the pool from push() until they are returned by pop_completed(),
+// which is how results get back to the main thread.
+class VoxelThreadPool {
+public:
+	VoxelThreadPool(int thread_count);
+	~VoxelThreadPool();
+
+	void push(VoxelTask * task);
+	void pop_completed(Vector<VoxelTask*> & out_tasks);
+
+	// Blocks until all pushed tasks have been run
+	void flush();
+
+	int get_pending_count() const;
+	int get_thread_count() const { return _threads.size(); }
+
+private:
+	struct ThreadData {
+		VoxelThreadPool * pool;
+		int index;
+	};
+
+	struct TaskHasher {
+		static _FORCE_INLINE_ uint32_t hash(const VoxelTask * task) { return hash_djb2_one_64((uint64_t)task); }
+	};
+
+	static void _thread_func(void * p_data);
+	void thread_func(int thread_index);
+
+	Vector<Thread*> _threads;
+	Vector<ThreadData*> _thread_data;
+	Mutex * _mutex;
+	Semaphore * _semaphore;
+
+	// Most urgent first
+	VoxelPriorityQueue<VoxelTask*, TaskHasher> _pending;
+	Vector<VoxelTask*> _completed;
+	int _running_count;
+
+	bool _quit;
+
+};
+
+#endif // VOXEL_THREAD_POOL_H